@@ -0,0 +1,355 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <stdlib.h>
+#include "fs.h"
+#include "graphics.h"
+#include "mixer.h"
+#include "profiler.h"
+#include "resource.h"
+#include "scaler.h"
+#include "systemstub.h"
+#include "unpack.h"
+#include "util.h"
+#include "video.h"
+
+// microbenchmarks for the pixel and sample kernels, on synthetic inputs
+
+Options g_options;
+const char *g_caption = "Flashback (bench)";
+
+static const int kW = Video::GAMESCREEN_W;
+static const int kH = Video::GAMESCREEN_H;
+static const uint64_t kMinDurationNs = 200 * 1000 * 1000;
+
+static const char *_filter;
+static uint32_t _rndState = 0x12345678;
+
+static uint32_t rnd() {
+	_rndState ^= _rndState << 13;
+	_rndState ^= _rndState >> 17;
+	_rndState ^= _rndState << 5;
+	return _rndState;
+}
+
+static void fillRandom(uint8_t *p, int size, int zeroRatio = 0) {
+	for (int i = 0; i < size; ++i) {
+		const uint32_t r = rnd();
+		p[i] = ((int)(r % 100) < zeroRatio) ? 0 : (r >> 8);
+	}
+}
+
+template<typename F>
+static void measure(const char *name, uint64_t unitsPerCall, const char *unit, F f) {
+	if (_filter && !strstr(name, _filter)) {
+		return;
+	}
+	f(); // warm up
+	uint64_t calls = 0;
+	const uint64_t start = Profiler::getTime();
+	uint64_t elapsed;
+	do {
+		f();
+		++calls;
+		elapsed = Profiler::getTime() - start;
+	} while (elapsed < kMinDurationNs);
+	printf("%-28s %10.3f ns/%s (%d calls)\n", name, elapsed / (double)(calls * unitsPerCall), unit, (int)calls);
+}
+
+static void benchStub(SystemStub *stub) {
+	uint8_t pal[256 * 3];
+	fillRandom(pal, sizeof(pal));
+	stub->setPalette(pal, 256);
+	uint8_t *buf = (uint8_t *)malloc(kW * kH);
+	uint8_t *rgb = (uint8_t *)malloc(kW * kH * 3);
+	fillRandom(buf, kW * kH);
+	fillRandom(rgb, kW * kH * 3);
+	measure("copyRect", kW * kH, "pixel", [&]() {
+		stub->copyRect(0, 0, kW, kH, buf, kW);
+	});
+	measure("copyRectRgb24", kW * kH, "pixel", [&]() {
+		stub->copyRectRgb24(0, 0, kW, kH, rgb);
+	});
+	measure("copyWidescreenBlur", kW * kH, "pixel", [&]() {
+		stub->copyWidescreenBlur(kW, kH, buf);
+	});
+	measure("copyWidescreenLeft", kW * kH, "pixel", [&]() {
+		stub->copyWidescreenLeft(kW, kH, buf);
+	});
+	free(buf);
+	free(rgb);
+}
+
+static void benchScaler(const Scaler *scaler) {
+	uint32_t *src = (uint32_t *)malloc(kW * kH * sizeof(uint32_t));
+	fillRandom((uint8_t *)src, kW * kH * sizeof(uint32_t));
+	// reduce the palette, xBRZ and scaleNx kernels depend on equal neighbours
+	for (int i = 0; i < kW * kH; ++i) {
+		src[i] &= 0xC0C0C0;
+	}
+	const int factorMax = scaler->factorMax;
+	uint32_t *dst = (uint32_t *)malloc(kW * factorMax * kH * factorMax * sizeof(uint32_t));
+	for (int factor = scaler->factorMin; factor <= factorMax; ++factor) {
+		char name[32];
+		snprintf(name, sizeof(name), "%s@%d", scaler->name, factor);
+		measure(name, kW * kH, "pixel", [&]() {
+			scaler->scale(factor, dst, kW * factor, src, kW, kW, kH);
+		});
+	}
+	free(src);
+	free(dst);
+}
+
+static void benchGraphics() {
+	uint8_t *layer = (uint8_t *)calloc(kW, kH);
+	Graphics gfx;
+	gfx.setLayer(layer, kW);
+	gfx.setClippingRect(0, 0, kW, kH);
+	static const int kPolygons = 64;
+	Point pts[kPolygons][4];
+	for (int i = 0; i < kPolygons; ++i) {
+		const int x = rnd() % (kW - 64);
+		const int y = rnd() % (kH - 64);
+		pts[i][0].x = x + rnd() % 32;      pts[i][0].y = y;
+		pts[i][1].x = x + 32 + rnd() % 32; pts[i][1].y = y + rnd() % 32;
+		pts[i][2].x = x + 32 + rnd() % 32; pts[i][2].y = y + 32 + rnd() % 32;
+		pts[i][3].x = x;                   pts[i][3].y = y + 32 + rnd() % 32;
+	}
+	// count the filled pixels once to report a per pixel cost
+	int area = 0;
+	for (int i = 0; i < kPolygons; ++i) {
+		memset(layer, 0, kW * kH);
+		gfx.drawPolygon(1, false, pts[i], 4);
+		for (int j = 0; j < kW * kH; ++j) {
+			area += layer[j];
+		}
+	}
+	measure("drawPolygon", area, "pixel", [&]() {
+		for (int i = 0; i < kPolygons; ++i) {
+			gfx.drawPolygon(i, false, pts[i], 4);
+		}
+	});
+	measure("drawPolygon (alpha)", area, "pixel", [&]() {
+		for (int i = 0; i < kPolygons; ++i) {
+			gfx.drawPolygon(0xC8 + (i & 7), true, pts[i], 4);
+		}
+	});
+	area = 0;
+	const Point center = { kW / 2, kH / 2 };
+	memset(layer, 0, kW * kH);
+	gfx.drawEllipse(1, false, &center, 96, 96);
+	for (int j = 0; j < kW * kH; ++j) {
+		area += layer[j];
+	}
+	measure("fillArea (ellipse)", area, "pixel", [&]() {
+		gfx.drawEllipse(0x40, false, &center, 96, 96);
+	});
+	measure("fillArea (ellipse alpha)", area, "pixel", [&]() {
+		gfx.drawEllipse(0xC8, true, &center, 96, 96);
+	});
+	free(layer);
+}
+
+static void benchSprites(Video *vid) {
+	static const int kSpriteW = 64;
+	static const int kSpriteH = 64;
+	uint8_t *spr = (uint8_t *)malloc(kSpriteW * kSpriteH);
+	fillRandom(spr, kSpriteW * kSpriteH, 30);
+	uint8_t *dst = vid->_frontLayer + 32 * kW + 32;
+	fillRandom(vid->_frontLayer, vid->_layerSize);
+	static const struct {
+		const char *name;
+		void (Video::*proc)(const uint8_t *, uint8_t *, int, int, int, uint8_t);
+		int offset;
+	} sprites[] = {
+		{ "drawSpriteSub1", &Video::drawSpriteSub1, 0 },
+		{ "drawSpriteSub2", &Video::drawSpriteSub2, kSpriteW - 1 },
+		{ "drawSpriteSub3", &Video::drawSpriteSub3, 0 },
+		{ "drawSpriteSub4", &Video::drawSpriteSub4, kSpriteW - 1 },
+		{ "drawSpriteSub5", &Video::drawSpriteSub5, 0 },
+		{ "drawSpriteSub6", &Video::drawSpriteSub6, (kSpriteH - 1) * kSpriteW },
+	};
+	for (unsigned int i = 0; i < ARRAYSIZE(sprites); ++i) {
+		measure(sprites[i].name, kSpriteW * kSpriteH, "pixel", [&]() {
+			(vid->*sprites[i].proc)(spr + sprites[i].offset, dst, kSpriteW, kSpriteH, kSpriteW, 0x10);
+		});
+	}
+	free(spr);
+}
+
+static void writeUint32BE(uint8_t *p, uint32_t n) {
+	p[0] = n >> 24;
+	p[1] = n >> 16;
+	p[2] = n >> 8;
+	p[3] = n;
+}
+
+struct BitWriter {
+	uint8_t *_bits;
+	int _count;
+
+	void putBits(uint32_t value, int count) {
+		for (int i = count - 1; i >= 0; --i) {
+			_bits[_count++] = (value >> i) & 1;
+		}
+	}
+};
+
+// encode a stream of literals and back references bytekiller_unpack accepts
+static int bytekillerPack(uint8_t *unpacked, int size, uint8_t *packed) {
+	BitWriter bw;
+	bw._bits = (uint8_t *)malloc(size * 16);
+	bw._count = 0;
+	int pos = size - 1; // the output is written backwards
+	while (pos >= 0) {
+		const int written = size - 1 - pos;
+		const int remain = pos + 1;
+		if (written >= 16 && (rnd() & 1)) {
+			const int len = MIN<int>(remain, 1 + rnd() % 256);
+			const int offset = 1 + rnd() % MIN<int>(written, 4095);
+			bw.putBits(1, 1);
+			bw.putBits(2, 2);
+			bw.putBits(len - 1, 8);
+			bw.putBits(offset, 12);
+			for (int i = 0; i < len; ++i) {
+				unpacked[pos - i] = unpacked[pos - i + offset];
+			}
+			pos -= len;
+		} else if (remain < 9) {
+			const int len = remain;
+			bw.putBits(0, 1);
+			bw.putBits(0, 1);
+			bw.putBits(len - 1, 3);
+			for (int i = 0; i < len; ++i) {
+				unpacked[pos - i] = rnd();
+				bw.putBits(unpacked[pos - i], 8);
+			}
+			pos -= len;
+		} else {
+			const int len = MIN<int>(remain, 9 + rnd() % 256);
+			bw.putBits(1, 1);
+			bw.putBits(3, 2);
+			bw.putBits(len - 9, 8);
+			for (int i = 0; i < len; ++i) {
+				unpacked[pos - i] = rnd();
+				bw.putBits(unpacked[pos - i], 8);
+			}
+			pos -= len;
+		}
+	}
+	// the words are consumed from the end of the buffer, bits from the lsb
+	const int firstBits = bw._count % 32;
+	const int wordsCount = 1 + bw._count / 32;
+	uint32_t *words = (uint32_t *)calloc(wordsCount, sizeof(uint32_t));
+	int bit = 0;
+	for (int i = 0; i < firstBits; ++i) {
+		words[0] |= (uint32_t)bw._bits[bit++] << i;
+	}
+	words[0] |= 1 << firstBits; // end marker for the first word
+	for (int w = 1; w < wordsCount; ++w) {
+		for (int i = 0; i < 32; ++i) {
+			words[w] |= (uint32_t)bw._bits[bit++] << i;
+		}
+	}
+	uint32_t crc = 0;
+	uint8_t *p = packed;
+	for (int w = wordsCount - 1; w >= 0; --w) {
+		writeUint32BE(p, words[w]); p += 4;
+		crc ^= words[w];
+	}
+	writeUint32BE(p, crc); p += 4;
+	writeUint32BE(p, size); p += 4;
+	free(words);
+	free(bw._bits);
+	return p - packed;
+}
+
+static void benchUnpack() {
+	static const int kSize = 0x10000;
+	uint8_t *unpacked = (uint8_t *)malloc(kSize);
+	uint8_t *packed = (uint8_t *)malloc(kSize * 2 + 16);
+	uint8_t *dst = (uint8_t *)malloc(kSize);
+	const int packedSize = bytekillerPack(unpacked, kSize, packed);
+	if (!bytekiller_unpack(dst, kSize, packed, packedSize) || memcmp(dst, unpacked, kSize) != 0) {
+		error("bytekiller_unpack() mismatch");
+	}
+	measure("bytekiller_unpack", kSize, "byte", [&]() {
+		bytekiller_unpack(dst, kSize, packed, packedSize);
+	});
+	free(unpacked);
+	free(packed);
+	free(dst);
+}
+
+static void benchMixer(Mixer *mix) {
+	static const int kSamples = 2048;
+	static const int kSfxSize = 8000;
+	uint8_t *sfx = (uint8_t *)malloc(kSfxSize);
+	fillRandom(sfx, kSfxSize);
+	int16_t buf[kSamples * 2];
+	measure("Mixer::mix", kSamples, "sample", [&]() {
+		mix->stopAll();
+		for (int i = 0; i < Mixer::NUM_CHANNELS; ++i) {
+			mix->play(sfx + i, kSfxSize - i, 6000 + i * 1000, Mixer::MAX_VOLUME >> (i & 1));
+		}
+		memset(buf, 0, sizeof(buf));
+		mix->mix(buf, kSamples);
+	});
+	mix->stopAll();
+	// the same effects converted to 16 bits at the output rate
+	SoundFx sfxList[Mixer::NUM_CHANNELS];
+	for (int i = 0; i < Mixer::NUM_CHANNELS; ++i) {
+		sfxList[i].data = sfx + i;
+		sfxList[i].len = kSfxSize - i;
+		sfxList[i].freq = 6000 + i * 1000;
+	}
+	mix->loadSfx(sfxList, Mixer::NUM_CHANNELS);
+	measure("Mixer::mix sfx", kSamples, "sample", [&]() {
+		mix->stopAll();
+		for (int i = 0; i < Mixer::NUM_CHANNELS; ++i) {
+			mix->playSfx(i, Mixer::MAX_VOLUME >> (i & 1));
+		}
+		memset(buf, 0, sizeof(buf));
+		mix->mix(buf, kSamples);
+	});
+	mix->stopAll();
+	mix->freeSfx();
+	free(sfx);
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1) {
+		_filter = argv[1];
+	}
+	g_debugMask = 0;
+	setenv("SDL_VIDEODRIVER", "dummy", 0);
+	setenv("SDL_AUDIODRIVER", "dummy", 0);
+	ScalerParameters scalerParameters = ScalerParameters::defaults();
+	SystemStub *stub = SystemStub_SDL_create();
+	stub->init(g_caption, kW, kH, false, kWidescreenBlur, &scalerParameters);
+	benchStub(stub);
+	stub->destroy();
+	delete stub;
+
+	benchScaler(&_internalScaler);
+	benchScaler(&scaler_xbr);
+	benchGraphics();
+	benchUnpack();
+
+	FileSystem fs("");
+	Resource res(&fs, kResourceTypeDOS, LANG_EN);
+	SystemStub *nullStub = SystemStub_Null_create(0);
+	nullStub->init(g_caption, kW, kH, false, kWidescreenNone, &scalerParameters);
+	Video vid(&res, nullStub, kWidescreenNone);
+	benchSprites(&vid);
+	Mixer mix(&fs, nullStub);
+	mix.init();
+	benchMixer(&mix);
+	mix.free();
+	nullStub->destroy();
+	delete nullStub;
+	return 0;
+}
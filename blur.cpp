@@ -0,0 +1,257 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#if defined(__SSE2__)
+#define BLUR_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#define BLUR_NEON
+#include <arm_neon.h>
+#endif
+#include "blur.h"
+#include "intern.h"
+
+// the window sums are kept on 16 bits and divided with a fixed point reciprocal,
+// (sum + 1) * (65536 / count) >> 16 matches sum / count for the radius values used
+static const uint16_t kSumBias = 1;
+
+static const int kStripW = 32;
+
+static inline uint64_t spread(uint32_t color) {
+	uint64_t x = color;
+	x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+	x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+	return x;
+}
+
+static inline uint32_t divide(uint64_t sum, uint32_t m) {
+	uint32_t color = 0;
+	for (int i = 0; i < 4; ++i) {
+		color |= ((((sum >> (i * 16)) & 0xFFFF) * m) >> 16) << (i * 8);
+	}
+	return color;
+}
+
+// 4 components sums packed in a 64 bits word
+static void blurRow_C(int radius, uint32_t *dst, const uint32_t *src, int w, uint16_t m) {
+	uint64_t sum = kSumBias * 0x0001000100010001ULL;
+	for (int x = -radius; x <= radius; ++x) {
+		sum += spread(src[CLIP(x, 0, w - 1)]);
+	}
+	dst[0] = divide(sum, m);
+	for (int x = 1; x < w; ++x) {
+		sum += spread(src[MIN(x + radius, w - 1)]);
+		sum -= spread(src[MAX(x - radius - 1, 0)]);
+		dst[x] = divide(sum, m);
+	}
+}
+
+// slides down a strip of columns, the sums of a row are contiguous
+static void blurColumns_C(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h, uint16_t m) {
+	assert(w <= kStripW);
+	const int count = w * 4;
+	uint16_t sum[kStripW * 4];
+	for (int i = 0; i < count; ++i) {
+		sum[i] = kSumBias;
+	}
+	for (int y = -radius; y <= radius; ++y) {
+		const uint8_t *p = (const uint8_t *)(src + CLIP(y, 0, h - 1) * srcPitch);
+		for (int i = 0; i < count; ++i) {
+			sum[i] += p[i];
+		}
+	}
+	for (int y = 0; y < h; ++y) {
+		if (y != 0) {
+			const uint8_t *in = (const uint8_t *)(src + MIN(y + radius, h - 1) * srcPitch);
+			const uint8_t *out = (const uint8_t *)(src + MAX(y - radius - 1, 0) * srcPitch);
+			for (int i = 0; i < count; ++i) {
+				sum[i] += in[i] - out[i];
+			}
+		}
+		uint8_t *p = (uint8_t *)(dst + y * dstPitch);
+		for (int i = 0; i < count; ++i) {
+			p[i] = (sum[i] * m) >> 16;
+		}
+	}
+}
+
+#ifdef BLUR_SSE2
+// 2 rows at once, one pixel per 64 bits lane
+static inline __m128i load2(const uint32_t *src0, const uint32_t *src1, int x) {
+	const __m128i p = _mm_unpacklo_epi32(_mm_cvtsi32_si128(src0[x]), _mm_cvtsi32_si128(src1[x]));
+	return _mm_unpacklo_epi8(p, _mm_setzero_si128());
+}
+
+static void blurRows2_SSE2(int radius, uint32_t *dst0, uint32_t *dst1, const uint32_t *src0, const uint32_t *src1, int w, uint16_t m) {
+	const __m128i mul = _mm_set1_epi16(m);
+	__m128i sum = _mm_set1_epi16(kSumBias);
+	for (int x = -radius; x <= radius; ++x) {
+		sum = _mm_add_epi16(sum, load2(src0, src1, CLIP(x, 0, w - 1)));
+	}
+	for (int x = 0; x < w; ++x) {
+		if (x != 0) {
+			sum = _mm_add_epi16(sum, load2(src0, src1, MIN(x + radius, w - 1)));
+			sum = _mm_sub_epi16(sum, load2(src0, src1, MAX(x - radius - 1, 0)));
+		}
+		const __m128i color = _mm_packus_epi16(_mm_mulhi_epu16(sum, mul), _mm_setzero_si128());
+		dst0[x] = _mm_cvtsi128_si32(color);
+		dst1[x] = _mm_cvtsi128_si32(_mm_srli_si128(color, 4));
+	}
+}
+
+// 8 columns at once, the sums stay in registers
+static inline void addRow8(__m128i *sum, const uint32_t *p) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_loadu_si128((const __m128i *)p);
+	const __m128i b = _mm_loadu_si128((const __m128i *)(p + 4));
+	sum[0] = _mm_add_epi16(sum[0], _mm_unpacklo_epi8(a, zero));
+	sum[1] = _mm_add_epi16(sum[1], _mm_unpackhi_epi8(a, zero));
+	sum[2] = _mm_add_epi16(sum[2], _mm_unpacklo_epi8(b, zero));
+	sum[3] = _mm_add_epi16(sum[3], _mm_unpackhi_epi8(b, zero));
+}
+
+static inline void subRow8(__m128i *sum, const uint32_t *p) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i a = _mm_loadu_si128((const __m128i *)p);
+	const __m128i b = _mm_loadu_si128((const __m128i *)(p + 4));
+	sum[0] = _mm_sub_epi16(sum[0], _mm_unpacklo_epi8(a, zero));
+	sum[1] = _mm_sub_epi16(sum[1], _mm_unpackhi_epi8(a, zero));
+	sum[2] = _mm_sub_epi16(sum[2], _mm_unpacklo_epi8(b, zero));
+	sum[3] = _mm_sub_epi16(sum[3], _mm_unpackhi_epi8(b, zero));
+}
+
+static void blurColumns8_SSE2(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int h, uint16_t m) {
+	const __m128i mul = _mm_set1_epi16(m);
+	__m128i sum[4];
+	for (int i = 0; i < 4; ++i) {
+		sum[i] = _mm_set1_epi16(kSumBias);
+	}
+	for (int y = -radius; y <= radius; ++y) {
+		addRow8(sum, src + CLIP(y, 0, h - 1) * srcPitch);
+	}
+	for (int y = 0; y < h; ++y) {
+		if (y != 0) {
+			addRow8(sum, src + MIN(y + radius, h - 1) * srcPitch);
+			subRow8(sum, src + MAX(y - radius - 1, 0) * srcPitch);
+		}
+		uint32_t *p = dst + y * dstPitch;
+		_mm_storeu_si128((__m128i *)p, _mm_packus_epi16(_mm_mulhi_epu16(sum[0], mul), _mm_mulhi_epu16(sum[1], mul)));
+		_mm_storeu_si128((__m128i *)(p + 4), _mm_packus_epi16(_mm_mulhi_epu16(sum[2], mul), _mm_mulhi_epu16(sum[3], mul)));
+	}
+}
+#endif
+
+#ifdef BLUR_NEON
+static inline uint16x8_t load2(const uint32_t *src0, const uint32_t *src1, int x) {
+	const uint32x2_t p = vset_lane_u32(src1[x], vdup_n_u32(src0[x]), 1);
+	return vmovl_u8(vreinterpret_u8_u32(p));
+}
+
+static inline uint8x8_t divide8(uint16x8_t sum, uint16x4_t mul) {
+	const uint16x4_t lo = vshrn_n_u32(vmull_u16(vget_low_u16(sum), mul), 16);
+	const uint16x4_t hi = vshrn_n_u32(vmull_u16(vget_high_u16(sum), mul), 16);
+	return vmovn_u16(vcombine_u16(lo, hi));
+}
+
+static inline uint8x16x2_t load8(const uint32_t *p) {
+	uint8x16x2_t v;
+	v.val[0] = vld1q_u8((const uint8_t *)p);
+	v.val[1] = vld1q_u8((const uint8_t *)(p + 4));
+	return v;
+}
+
+static void blurRows2_NEON(int radius, uint32_t *dst0, uint32_t *dst1, const uint32_t *src0, const uint32_t *src1, int w, uint16_t m) {
+	const uint16x4_t mul = vdup_n_u16(m);
+	uint16x8_t sum = vdupq_n_u16(kSumBias);
+	for (int x = -radius; x <= radius; ++x) {
+		sum = vaddq_u16(sum, load2(src0, src1, CLIP(x, 0, w - 1)));
+	}
+	for (int x = 0; x < w; ++x) {
+		if (x != 0) {
+			sum = vaddq_u16(sum, load2(src0, src1, MIN(x + radius, w - 1)));
+			sum = vsubq_u16(sum, load2(src0, src1, MAX(x - radius - 1, 0)));
+		}
+		const uint32x2_t color = vreinterpret_u32_u8(divide8(sum, mul));
+		dst0[x] = vget_lane_u32(color, 0);
+		dst1[x] = vget_lane_u32(color, 1);
+	}
+}
+
+static void blurColumns8_NEON(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int h, uint16_t m) {
+	const uint16x4_t mul = vdup_n_u16(m);
+	uint16x8_t sum[4];
+	for (int i = 0; i < 4; ++i) {
+		sum[i] = vdupq_n_u16(kSumBias);
+	}
+	for (int y = -radius; y <= radius; ++y) {
+		const uint8x16x2_t p = load8(src + CLIP(y, 0, h - 1) * srcPitch);
+		for (int i = 0; i < 2; ++i) {
+			sum[i * 2]     = vaddw_u8(sum[i * 2],     vget_low_u8(p.val[i]));
+			sum[i * 2 + 1] = vaddw_u8(sum[i * 2 + 1], vget_high_u8(p.val[i]));
+		}
+	}
+	for (int y = 0; y < h; ++y) {
+		if (y != 0) {
+			const uint8x16x2_t in = load8(src + MIN(y + radius, h - 1) * srcPitch);
+			const uint8x16x2_t out = load8(src + MAX(y - radius - 1, 0) * srcPitch);
+			for (int i = 0; i < 2; ++i) {
+				sum[i * 2]     = vsubw_u8(vaddw_u8(sum[i * 2],     vget_low_u8(in.val[i])),  vget_low_u8(out.val[i]));
+				sum[i * 2 + 1] = vsubw_u8(vaddw_u8(sum[i * 2 + 1], vget_high_u8(in.val[i])), vget_high_u8(out.val[i]));
+			}
+		}
+		uint8_t *p = (uint8_t *)(dst + y * dstPitch);
+		vst1q_u8(p,      vcombine_u8(divide8(sum[0], mul), divide8(sum[1], mul)));
+		vst1q_u8(p + 16, vcombine_u8(divide8(sum[2], mul), divide8(sum[3], mul)));
+	}
+}
+#endif
+
+static void blurHorizontal(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h, uint16_t m) {
+	int y = 0;
+#if defined(BLUR_SSE2)
+	for (; y + 2 <= h; y += 2) {
+		blurRows2_SSE2(radius, dst, dst + dstPitch, src, src + srcPitch, w, m);
+		dst += dstPitch * 2;
+		src += srcPitch * 2;
+	}
+#elif defined(BLUR_NEON)
+	for (; y + 2 <= h; y += 2) {
+		blurRows2_NEON(radius, dst, dst + dstPitch, src, src + srcPitch, w, m);
+		dst += dstPitch * 2;
+		src += srcPitch * 2;
+	}
+#endif
+	for (; y < h; ++y) {
+		blurRow_C(radius, dst, src, w, m);
+		dst += dstPitch;
+		src += srcPitch;
+	}
+}
+
+static void blurVertical(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h, uint16_t m) {
+	int x = 0;
+#if defined(BLUR_SSE2)
+	for (; x + 8 <= w; x += 8) {
+		blurColumns8_SSE2(radius, dst + x, dstPitch, src + x, srcPitch, h, m);
+	}
+#elif defined(BLUR_NEON)
+	for (; x + 8 <= w; x += 8) {
+		blurColumns8_NEON(radius, dst + x, dstPitch, src + x, srcPitch, h, m);
+	}
+#endif
+	for (; x < w; x += kStripW) {
+		blurColumns_C(radius, dst + x, dstPitch, src + x, srcPitch, MIN(w - x, kStripW), h, m);
+	}
+}
+
+void blurImage(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h, uint32_t *tmp) {
+	const int count = 2 * radius + 1;
+	assert(radius > 0 && count * 255 + kSumBias <= 0xFFFF);
+	const uint16_t m = 65536 / count;
+	blurHorizontal(radius, tmp, w, src, srcPitch, w, h, m);
+	blurVertical(radius, dst, dstPitch, tmp, w, w, h, m);
+}
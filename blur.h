@@ -0,0 +1,15 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef BLUR_H__
+#define BLUR_H__
+
+#include <stdint.h>
+
+// box blur of 32-bit pixels, each of the 4 bytes is averaged separately ; 'tmp' holds w*h pixels
+void blurImage(int radius, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h, uint32_t *tmp);
+
+#endif // BLUR_H__
@@ -66,10 +66,11 @@ bool CpcPlayer::nextChunk() {
 				_f.read(buf, sizeof(buf));
 				const uint32_t rate = _f.readUint32BE();
 				const uint32_t channels = _f.readUint32BE();
-				if (channels != 2 || rate != _mix->getSampleRate()) {
+				if (channels != 2) {
 					warning("Unsupported CPC tune channels %d rate %d", channels, rate);
 					break;
 				}
+				_resampler.init(channels, rate, _mix->getSampleRate());
 				_f.read(_compression, sizeof(_compression) - 1);
 				_compression[sizeof(_compression) - 1] = 0;
 				if (strcmp(_compression, "SDX2") != 0) {
@@ -115,15 +116,25 @@ int8_t CpcPlayer::readSampleData() {
 	return data;
 }
 
-bool CpcPlayer::mix(int16_t *buf, int len) {
-	for (int i = 0; i < len; ++i) {
+int CpcPlayer::readFrames(int16_t *buf, int frames) {
+	for (int i = 0; i < frames; ++i) {
 		_sampleL = decodeSDX2(_sampleL, readSampleData());
 		_sampleR = decodeSDX2(_sampleR, readSampleData());
-		*buf++ = (_sampleL + _sampleR) / 2;
+		*buf++ = _sampleL;
+		*buf++ = _sampleR;
 	}
+	return frames;
+}
+
+bool CpcPlayer::mix(int16_t *buf, int len) {
+	_resampler.mix(buf, len, readFramesCallback, this);
 	return true;
 }
 
+int CpcPlayer::readFramesCallback(void *param, int16_t *buf, int frames) {
+	return ((CpcPlayer *)param)->readFrames(buf, frames);
+}
+
 bool CpcPlayer::mixCallback(void *param, int16_t *buf, int len) {
 	return ((CpcPlayer *)param)->mix(buf, len);
 }
@@ -4,6 +4,7 @@
 
 #include "intern.h"
 #include "file.h"
+#include "resampler.h"
 
 struct FileSystem;
 struct Mixer;
@@ -19,6 +20,7 @@ struct CpcPlayer {
 	char _compression[5];
 	int _samplesLeft;
 	int16_t _sampleL, _sampleR;
+	Resampler _resampler;
 
 	CpcPlayer(Mixer *mixer, FileSystem *fs);
 	~CpcPlayer();
@@ -30,7 +32,9 @@ struct CpcPlayer {
 
 	bool nextChunk();
 	int8_t readSampleData();
+	int readFrames(int16_t *buf, int frames);
 	bool mix(int16_t *buf, int len);
+	static int readFramesCallback(void *param, int16_t *buf, int frames);
 	static bool mixCallback(void *param, int16_t *buf, int len);
 };
 
@@ -5,6 +5,13 @@
  */
 
 #include <sys/param.h>
+#ifndef _WIN32
+#define USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #include "file.h"
 #include "fs.h"
 #include "util.h"
@@ -26,6 +33,8 @@ struct File_impl {
 	virtual void seek(int32_t off) = 0;
 	virtual uint32_t read(void *ptr, uint32_t len) = 0;
 	virtual uint32_t write(const void *ptr, uint32_t len) = 0;
+	virtual const uint8_t *mappedData() { return 0; }
+	virtual bool map(FileMapping *mapping) { return false; }
 };
 
 struct StdioFile : File_impl {
@@ -79,6 +88,94 @@ struct StdioFile : File_impl {
 	}
 };
 
+#ifdef USE_MMAP
+struct MmapFile : File_impl {
+	int _fd;
+	uint8_t *_ptr;
+	uint32_t _size, _offset;
+	MmapFile() : _fd(-1), _ptr(0), _size(0), _offset(0) {}
+	bool open(const char *path, const char *mode) {
+		_ioErr = false;
+		_fd = ::open(path, O_RDONLY);
+		if (_fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(_fd, &st) == 0 && st.st_size > 0) {
+			void *p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, _fd, 0);
+			if (p != MAP_FAILED) {
+				_ptr = (uint8_t *)p;
+				_size = st.st_size;
+				_offset = 0;
+				return true;
+			}
+		}
+		// empty files can not be mapped
+		::close(_fd);
+		_fd = -1;
+		return false;
+	}
+	void close() {
+		if (_ptr) {
+			munmap(_ptr, _size);
+			_ptr = 0;
+		}
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
+		}
+	}
+	uint32_t size() {
+		return _size;
+	}
+	void seek(int32_t off) {
+		_offset = off;
+	}
+	uint32_t read(void *ptr, uint32_t len) {
+		const uint32_t avail = (_offset < _size) ? _size - _offset : 0;
+		uint32_t count = len;
+		if (count > avail) {
+			count = avail;
+			_ioErr = true;
+		}
+		if (count != 0) {
+			memcpy(ptr, _ptr + _offset, count);
+			_offset += count;
+		}
+		return count;
+	}
+	uint32_t write(const void *ptr, uint32_t len) {
+		_ioErr = true;
+		return 0;
+	}
+	const uint8_t *mappedData() {
+		return _ptr;
+	}
+	bool map(FileMapping *mapping) {
+		if (_fd >= 0) {
+			// private writable pages, the file is left untouched
+			void *p = mmap(0, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, _fd, 0);
+			if (p != MAP_FAILED) {
+				mapping->data = (uint8_t *)p;
+				mapping->size = _size;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+#endif
+
+void FileMapping::release() {
+#ifdef USE_MMAP
+	if (data) {
+		munmap(data, size);
+	}
+#endif
+	data = 0;
+	size = 0;
+}
+
 #ifdef USE_ZLIB
 struct GzipFile : File_impl {
 	gzFile _fp;
@@ -205,6 +302,11 @@ struct MemoryBufferFile: File_impl {
 		_ptr = (uint8_t *)malloc(_capacity);
 		_offset = _len = 0;
 	}
+	MemoryBufferFile(uint8_t *ptr, uint32_t size) {
+		_capacity = _len = size;
+		_ptr = ptr;
+		_offset = 0;
+	}
 	~MemoryBufferFile() {
 		free(_ptr);
 	}
@@ -267,14 +369,25 @@ bool File::open(const char *filename, const char *mode, FileSystem *fs) {
 		_impl = 0;
 	}
 	assert(mode[0] != 'z');
-	_impl = new StdioFile;
 	char *path = fs->findPath(filename);
 	if (path) {
 		debug(DBG_FILE, "Open file name '%s' mode '%s' path '%s'", filename, mode, path);
+#ifdef USE_MMAP
+		if (strcmp(mode, "rb") == 0) {
+			_impl = new MmapFile;
+			if (_impl->open(path, mode)) {
+				free(path);
+				return true;
+			}
+			delete _impl;
+		}
+#endif
+		_impl = new StdioFile;
 		bool ret = _impl->open(path, mode);
 		free(path);
 		return ret;
 	}
+	_impl = new StdioFile;
 #ifdef USE_RWOPS
 	if (mode[0] == 'r') {
 		_impl = new AssetFile;
@@ -325,6 +438,16 @@ void File::openMemoryBuffer(int initialCapacity) {
 	_impl = new MemoryBufferFile(initialCapacity);
 }
 
+void File::openMemoryBuffer(uint8_t *ptr, uint32_t size) {
+	if (_impl) {
+		_impl->close();
+		delete _impl;
+		_impl = 0;
+	}
+	// takes ownership of the buffer
+	_impl = new MemoryBufferFile(ptr, size);
+}
+
 void File::close() {
 	if (_impl) {
 		_impl->close();
@@ -347,6 +470,14 @@ uint32_t File::read(void *ptr, uint32_t len) {
 	return _impl->read(ptr, len);
 }
 
+const uint8_t *File::mappedData() {
+	return _impl->mappedData();
+}
+
+bool File::map(FileMapping *mapping) {
+	return _impl->map(mapping);
+}
+
 uint8_t File::readByte() {
 	uint8_t b;
 	read(&b, 1);
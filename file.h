@@ -12,6 +12,15 @@
 struct File_impl;
 struct FileSystem;
 
+// copy-on-write memory mapping of a data file, the pages are read when accessed ;
+// no constructor, the owner zeroes the structure
+struct FileMapping {
+	uint8_t *data;
+	uint32_t size;
+
+	void release();
+};
+
 struct File {
 	File();
 	~File();
@@ -21,11 +30,14 @@ struct File {
 	bool open(const char *filename, const char *mode, FileSystem *fs);
 	bool open(const char *filename, const char *mode, const char *directory);
 	void openMemoryBuffer(int initialCapacity);
+	void openMemoryBuffer(uint8_t *ptr, uint32_t size);
 	void close();
 	bool ioErr() const;
 	uint32_t size();
 	void seek(int32_t off);
 	uint32_t read(void *ptr, uint32_t len);
+	const uint8_t *mappedData(); // file content when memory mapped, valid while the file is open
+	bool map(FileMapping *mapping); // maps the file content, released by the caller
 	uint8_t readByte();
 	uint16_t readUint16LE();
 	uint32_t readUint32LE();
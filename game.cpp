@@ -9,6 +9,7 @@
 #include "file.h"
 #include "fs.h"
 #include "game.h"
+#include "profiler.h"
 #include "seq_player.h"
 #include "systemstub.h"
 #include "unpack.h"
@@ -21,6 +22,8 @@ Game::Game(SystemStub *stub, FileSystem *fs, FileSystem *tune_fs, const char *sa
 	_stub(stub), _fs(fs), _savePath(savePath) {
 	_stateSlot = 1;
 	_inp_demPos = 0;
+	_inp_logName = 0;
+	_inp_logReplay = false;
 	_skillLevel = _menu._skill = kSkillNormal;
 	_currentLevel = _menu._level = level;
 	_demoBin = _shownDemo = -1;
@@ -90,11 +93,13 @@ void Game::run() {
 		_res.load("PERSO", Resource::OT_SPR);
 		_res.load_SPR_OFF("PERSO", _res._spr1);
 		_res.load_FIB("GLOBAL");
+		_mix.loadSfx(_res._sfxList, _res._numSfx);
 		break;
 	case kResourceTypeMac:
 		_res.MAC_loadIconData();
 		_res.MAC_loadPersoData();
 		_res.MAC_loadSounds();
+		_mix.loadSfx(_res._sfxList, _res._numSfx);
 		break;
 	}
 
@@ -108,7 +113,16 @@ void Game::run() {
 
 	bool presentMenu = ((_res._type != kResourceTypeDOS) || _res.fileExists("MENU1.MAP"));
 	while (!_stub->_pi.quit) {
-		if (presentMenu) {
+		if (_inp_logName && _inp_logReplay) {
+			if (_inp_log.openReplay(_inp_logName, _savePath)) {
+				_demoBin = -1;
+				_skillLevel = _inp_log._skill;
+				_currentLevel = _inp_log._level;
+				_randSeed = _inp_log._seed;
+			} else {
+				_stub->_pi.quit = true;
+			}
+		} else if (presentMenu) {
 			_mix.playMusic(1);
 			switch (_res._type) {
 			case kResourceTypeDOS:
@@ -163,8 +177,16 @@ void Game::run() {
 			_vid._unkPalSlot2 = 0;
 			_score = 0;
 			clearStateRewind();
+			const uint32_t seed = _randSeed;
 			loadLevelData();
 			resetGameState();
+			if (_inp_logName) {
+				if (!_inp_logReplay) {
+					_inp_log.openRecord(_inp_logName, _savePath, seed, _currentLevel, _currentRoom, _skillLevel);
+				} else if (_inp_log._room != _currentRoom) {
+					warning("Input log starts in room %d, current room %d", _inp_log._room, _currentRoom);
+				}
+			}
 			_endLoop = false;
 			_frameTimestamp = _stub->getTimeStamp();
 			_saveTimestamp = _frameTimestamp;
@@ -177,6 +199,13 @@ void Game::run() {
 					_endLoop = true;
 				}
 			}
+			if (_inp_logName) {
+				_inp_log.close();
+				if (_inp_logReplay) {
+					// single session
+					_stub->_pi.quit = true;
+				}
+			}
 			// flush inputs
 			_stub->_pi.dirMask = 0;
 			_stub->_pi.enter = false;
@@ -407,11 +436,19 @@ void Game::mainLoop() {
 			return;
 		}
 	}
+	g_profiler.begin(kProfileFrame);
 	memcpy(_vid._frontLayer, _vid._backLayer, _vid._layerSize);
+	g_profiler.begin(kProfileInput);
 	pge_getInput();
+	g_profiler.end(kProfileInput);
+	g_profiler.begin(kProfilePrepare);
 	pge_prepare();
+	g_profiler.end(kProfilePrepare);
+	g_profiler.begin(kProfileCollision);
 	col_prepareRoomState();
+	g_profiler.end(kProfileCollision);
 	uint8_t oldLevel = _currentLevel;
+	g_profiler.begin(kProfileProcess);
 	for (uint16_t i = 0; i < _res._pgeNum; ++i) {
 		LivePGE *pge = _pge_liveTable2[i];
 		if (pge) {
@@ -420,6 +457,7 @@ void Game::mainLoop() {
 			pge_process(pge);
 		}
 	}
+	g_profiler.end(kProfileProcess);
 	if (oldLevel != _currentLevel) {
 		if (_res._isDemo) {
 			_currentLevel = oldLevel;
@@ -433,12 +471,14 @@ void Game::mainLoop() {
 			_cut._id = 6;
 			_deathCutsceneCounter = 1;
 		} else {
+			ProfileScope ps(kProfileLoadMap);
 			_currentRoom = _pgeLive[0].room_location;
 			loadLevelMap();
 			_loadMap = false;
 			_vid.fullRefresh();
 		}
 	}
+	g_profiler.begin(kProfileAnims);
 	prepareAnims();
 	drawAnims();
 	drawCurrentInventoryItem();
@@ -446,10 +486,15 @@ void Game::mainLoop() {
 	if (g_options.enable_password_menu) {
 		printLevelCode();
 	}
+	g_profiler.end(kProfileAnims);
 	if (_blinkingConradCounter != 0) {
 		--_blinkingConradCounter;
 	}
+	g_profiler.begin(kProfileUpdateScreen);
 	_vid.updateScreen();
+	g_profiler.end(kProfileUpdateScreen);
+	g_profiler.end(kProfileFrame);
+	g_profiler.endFrame();
 	updateTiming();
 	drawStoryTexts();
 	if (_stub->_pi.backspace) {
@@ -467,6 +512,7 @@ void Game::mainLoop() {
 	if (_autoSave && _stub->getTimeStamp() - _saveTimestamp >= kAutoSaveIntervalMs) {
 		// do not save if we died or about to
 		if (_pgeLive[0].life > 0 && _deathCutsceneCounter == 0) {
+			ProfileScope ps(kProfileAutoSave);
 			saveGameState(kAutoSaveSlot);
 			_saveTimestamp = _stub->getTimeStamp();
 		}
@@ -592,6 +638,14 @@ void Game::inp_handleSpecialKeys() {
 	if (_stub->_pi.dbgMask & PlayerInput::DF_SETLIFE) {
 		_pgeLive[0].life = 0x7FFF;
 	}
+	if (_inp_log._mode != InputLog::kModeNone) {
+		// the game states are not part of the input log
+		_stub->_pi.load = false;
+		_stub->_pi.save = false;
+		_stub->_pi.stateSlot = 0;
+		_stub->_pi.rewind = false;
+		return;
+	}
 	if (_stub->_pi.load) {
 		loadGameState(_stateSlot);
 		_stub->_pi.load = false;
@@ -996,9 +1050,17 @@ void Game::drawStoryTexts() {
 				_mix.play(voiceSegmentData, voiceSegmentLen, 32000, Mixer::MAX_VOLUME);
 			}
 			_vid.updateScreen();
-			while (!_stub->_pi.backspace && !_stub->_pi.quit) {
-				if (voiceSegmentData && !_mix.isPlaying(voiceSegmentData)) {
-					break;
+			// the mixer state is not reproducible, end the segment on a frames count with an input log
+			const uint32_t voiceFrames = (voiceSegmentLen * 1000 / 32000 + 79) / 80;
+			for (uint32_t frame = 0; !_stub->_pi.backspace && !_stub->_pi.quit; ++frame) {
+				if (voiceSegmentData) {
+					if (_inp_log._mode != InputLog::kModeNone) {
+						if (frame >= voiceFrames) {
+							break;
+						}
+					} else if (!_mix.isPlaying(voiceSegmentData)) {
+						break;
+					}
 				}
 				inp_update();
 				_stub->sleep(80);
@@ -1665,6 +1727,7 @@ void Game::loadLevelData() {
 			_res.load(fname1, Resource::OT_ANI);
 			_res.load(fname2, Resource::OT_TBN);
 			_res.load_SPL_demo();
+			_mix.loadSfx(_res._sfxList, _res._numSfx);
 			_res.load("level1", Resource::OT_SGD);
 			break;
 		}
@@ -1697,6 +1760,7 @@ void Game::loadLevelData() {
 			char name[8];
 			snprintf(name, sizeof(name), "level%d", lvl->sound);
 			_res.load(name, Resource::OT_SPL);
+			_mix.loadSfx(_res._sfxList, _res._numSfx);
 		}
 		if (_currentLevel == 0) {
 			_res.load(lvl->nameAmiga, Resource::OT_SGD);
@@ -1726,6 +1790,9 @@ void Game::loadLevelData() {
 		_res.MAC_loadLevelData(_currentLevel);
 		break;
 	}
+	if (_currentLevel < 6) {
+		prefetchLevelData(_currentLevel + 1);
+	}
 
 	_cut._id = lvl->cutscene_id;
 	if (_res._isDemo && _currentLevel == 5) { // PC demo does not include TELEPORT.*
@@ -1776,6 +1843,50 @@ void Game::loadLevelData() {
 	_mix.playMusic(Mixer::MUSIC_TRACK + lvl->track);
 }
 
+void Game::prefetchLevelData(int level) {
+	if (_res._isDemo) {
+		return;
+	}
+	// read the files of the next level while this one is played, see loadLevelData() ;
+	// the MBK and MAP files are memory mapped and not prefetched
+	const Level *lvl = &_gameLevels[level];
+	switch (_res._type) {
+	case kResourceTypeAmiga: {
+			const char *name = (level == 4) ? _gameLevels[3].nameAmiga : lvl->nameAmiga;
+			_res.prefetch((level == 6) ? _gameLevels[5].nameAmiga : name, Resource::OT_CT);
+			_res.prefetch(name, Resource::OT_PAL);
+			_res.prefetch(name, Resource::OT_RPC);
+			_res.prefetch(name, Resource::OT_SPC);
+			_res.prefetch((level == 1) ? "level2_1" : name, Resource::OT_LEV);
+			_res.prefetch(lvl->nameAmiga, Resource::OT_PGE);
+			_res.prefetch(lvl->nameAmiga, Resource::OT_OBC);
+			_res.prefetch(lvl->nameAmiga, Resource::OT_ANI);
+			_res.prefetch(lvl->nameAmiga, Resource::OT_TBN);
+			char splName[16];
+			snprintf(splName, sizeof(splName), "level%d", lvl->sound);
+			_res.prefetch(splName, Resource::OT_SPL);
+		}
+		break;
+	case kResourceTypeDOS:
+		_res.prefetch(lvl->name, Resource::OT_CT);
+		_res.prefetch(lvl->name, Resource::OT_PAL);
+		_res.prefetch(lvl->name, Resource::OT_RP);
+		if (g_options.use_tile_data) {
+			_res.prefetch(lvl->name, Resource::OT_LEV);
+			_res.prefetch(lvl->name, Resource::OT_BNQ);
+		}
+		_res.prefetch(lvl->name2, Resource::OT_PGE);
+		_res.prefetch(lvl->name2, Resource::OT_OBJ);
+		_res.prefetch(lvl->name2, Resource::OT_ANI);
+		_res.prefetch(lvl->name2, Resource::OT_TBN);
+		break;
+	case kResourceTypeMac:
+		// the level data is read from the resource fork
+		return;
+	}
+	_res.startPrefetch();
+}
+
 void Game::drawIcon(uint8_t iconNum, int16_t x, int16_t y, uint8_t colMask) {
 	uint8_t buf[16 * 16];
 	switch (_res._type) {
@@ -1833,7 +1944,7 @@ void Game::playSound(uint8_t num, uint8_t softVol) {
 		SoundFx *sfx = &_res._sfxList[num];
 		if (sfx->data) {
 			const int volume = Mixer::MAX_VOLUME >> (2 * softVol);
-			_mix.play(sfx->data, sfx->len, sfx->freq, volume);
+			_mix.playSfx(num, volume);
 		}
 	} else if (num == 66) {
 		// open/close inventory (DOS)
@@ -2009,6 +2120,17 @@ void Game::handleInventory() {
 
 void Game::inp_update() {
 	_stub->processEvents();
+	switch (_inp_log._mode) {
+	case InputLog::kModeRecord:
+		_inp_log.recordFrame(&_stub->_pi);
+		break;
+	case InputLog::kModeReplay:
+		if (!_inp_log.replayFrame(&_stub->_pi)) {
+			_inp_log.close();
+			_endLoop = true;
+		}
+		break;
+	}
 	if (_demoBin != -1 && _inp_demPos < _res._demLen) {
 		const int keymask = _res._dem[_inp_demPos++];
 		_stub->_pi.dirMask = keymask & 0xF;
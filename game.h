@@ -9,6 +9,7 @@
 
 #include "intern.h"
 #include "cutscene.h"
+#include "input_log.h"
 #include "menu.h"
 #include "mixer.h"
 #include "resource.h"
@@ -117,6 +118,7 @@ struct Game {
 	bool hasLevelMap(int level, int room) const;
 	void loadLevelMap();
 	void loadLevelData();
+	void prefetchLevelData(int level);
 	void drawIcon(uint8_t iconNum, int16_t x, int16_t y, uint8_t colMask);
 	void drawCurrentInventoryItem();
 	void printLevelCode();
@@ -375,6 +377,9 @@ struct Game {
 	uint8_t _inp_lastKeysHit;
 	uint8_t _inp_lastKeysHitLeftRight;
 	int _inp_demPos;
+	InputLog _inp_log;
+	const char *_inp_logName;
+	bool _inp_logReplay;
 
 	void inp_handleSpecialKeys();
 	void inp_update();
@@ -0,0 +1,189 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "input_log.h"
+#include "systemstub.h"
+#include "util.h"
+
+// header: tag, version, seed, level, room, skill
+// frames: runs of (varint length, varint keymask xor previous run keymask), 0 terminated
+// the low byte of the keymask uses the bit layout of the .DEM files, the high byte has
+// the other inputs changing the game state
+
+const uint32_t InputLog::TAG = 0x4642494E; // 'FBIN'
+
+static const uint16_t kVersion = 2;
+
+static uint16_t getKeyMask(const PlayerInput *pi) {
+	uint16_t mask = pi->dirMask & 0xF;
+	if (pi->enter) {
+		mask |= 0x10;
+	}
+	if (pi->space) {
+		mask |= 0x20;
+	}
+	if (pi->shift) {
+		mask |= 0x40;
+	}
+	if (pi->backspace) {
+		mask |= 0x80;
+	}
+	if (pi->escape) {
+		mask |= 0x100;
+	}
+	if (pi->dbgMask & PlayerInput::DF_SETLIFE) {
+		mask |= 0x200;
+	}
+	return mask;
+}
+
+static void setKeyMask(PlayerInput *pi, uint16_t mask) {
+	pi->dirMask = mask & 0xF;
+	pi->enter = (mask & 0x10) != 0;
+	pi->space = (mask & 0x20) != 0;
+	pi->shift = (mask & 0x40) != 0;
+	pi->backspace = (mask & 0x80) != 0;
+	pi->escape = (mask & 0x100) != 0;
+	if (mask & 0x200) {
+		pi->dbgMask |= PlayerInput::DF_SETLIFE;
+	} else {
+		pi->dbgMask &= ~PlayerInput::DF_SETLIFE;
+	}
+	// the game state keys are ignored with an input log, see Game::inp_handleSpecialKeys
+	pi->lastChar = 0;
+	pi->save = false;
+	pi->load = false;
+	pi->stateSlot = 0;
+	pi->rewind = false;
+}
+
+InputLog::InputLog()
+	: _mode(kModeNone) {
+}
+
+InputLog::~InputLog() {
+	close();
+}
+
+bool InputLog::openRecord(const char *filename, const char *directory, uint32_t seed, uint8_t level, uint8_t room, uint8_t skill) {
+	close();
+	if (!_f.open(filename, "wb", directory)) {
+		warning("Unable to open input log '%s' for writing", filename);
+		return false;
+	}
+	_f.writeUint32BE(TAG);
+	_f.writeUint16BE(kVersion);
+	_f.writeUint32BE(seed);
+	_f.writeByte(level);
+	_f.writeByte(room);
+	_f.writeByte(skill);
+	_seed = seed;
+	_level = level;
+	_room = room;
+	_skill = skill;
+	_keyMask = _prevKeyMask = 0;
+	_runLength = 0;
+	_framesCount = 0;
+	_mode = kModeRecord;
+	return true;
+}
+
+bool InputLog::openReplay(const char *filename, const char *directory) {
+	close();
+	if (!_f.open(filename, "rb", directory)) {
+		warning("Unable to open input log '%s'", filename);
+		return false;
+	}
+	const uint32_t tag = _f.readUint32BE();
+	const uint16_t version = _f.readUint16BE();
+	if (tag != TAG || version != kVersion) {
+		warning("Unsupported input log '%s' tag 0x%X version %d", filename, tag, version);
+		_f.close();
+		return false;
+	}
+	_seed = _f.readUint32BE();
+	_level = _f.readByte();
+	_room = _f.readByte();
+	_skill = _f.readByte();
+	_keyMask = 0;
+	_runLength = 0;
+	_framesCount = 0;
+	_mode = kModeReplay;
+	debug(DBG_DEMO, "Input log '%s' level %d room %d seed 0x%X", filename, _level, _room, _seed);
+	return true;
+}
+
+void InputLog::close() {
+	if (_mode == kModeRecord) {
+		writeRun();
+		writeVarint(0);
+		if (_f.ioErr()) {
+			warning("I/O error when writing input log");
+		}
+		debug(DBG_DEMO, "Recorded %d frames", _framesCount);
+	}
+	if (_mode != kModeNone) {
+		_f.close();
+		_mode = kModeNone;
+	}
+}
+
+void InputLog::recordFrame(const PlayerInput *pi) {
+	assert(_mode == kModeRecord);
+	const uint16_t mask = getKeyMask(pi);
+	if (_runLength != 0 && mask != _keyMask) {
+		writeRun();
+	}
+	_keyMask = mask;
+	++_runLength;
+	++_framesCount;
+}
+
+bool InputLog::replayFrame(PlayerInput *pi) {
+	assert(_mode == kModeReplay);
+	if (_runLength == 0) {
+		_runLength = readVarint();
+		if (_runLength == 0 || _f.ioErr()) {
+			debug(DBG_DEMO, "End of input log, %d frames", _framesCount);
+			_runLength = 0;
+			return false;
+		}
+		_keyMask ^= readVarint();
+	}
+	--_runLength;
+	++_framesCount;
+	setKeyMask(pi, _keyMask);
+	return true;
+}
+
+void InputLog::writeRun() {
+	if (_runLength != 0) {
+		writeVarint(_runLength);
+		writeVarint(_keyMask ^ _prevKeyMask);
+		_prevKeyMask = _keyMask;
+		_runLength = 0;
+	}
+}
+
+void InputLog::writeVarint(uint32_t n) {
+	while (n >= 0x80) {
+		_f.writeByte((n & 0x7F) | 0x80);
+		n >>= 7;
+	}
+	_f.writeByte(n);
+}
+
+uint32_t InputLog::readVarint() {
+	uint32_t n = 0;
+	for (int shift = 0; shift < 32; shift += 7) {
+		const uint8_t b = _f.readByte();
+		n |= (b & 0x7F) << shift;
+		if ((b & 0x80) == 0 || _f.ioErr()) {
+			break;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,48 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef INPUT_LOG_H__
+#define INPUT_LOG_H__
+
+#include "intern.h"
+#include "file.h"
+
+struct PlayerInput;
+
+struct InputLog {
+	enum {
+		kModeNone,
+		kModeRecord,
+		kModeReplay
+	};
+
+	static const uint32_t TAG;
+
+	File _f;
+	int _mode;
+	uint32_t _seed;
+	uint8_t _level, _room, _skill;
+	uint16_t _keyMask;
+	uint16_t _prevKeyMask;
+	uint32_t _runLength;
+	uint32_t _framesCount;
+
+	InputLog();
+	~InputLog();
+
+	bool openRecord(const char *filename, const char *directory, uint32_t seed, uint8_t level, uint8_t room, uint8_t skill);
+	bool openReplay(const char *filename, const char *directory);
+	void close();
+
+	void recordFrame(const PlayerInput *pi);
+	bool replayFrame(PlayerInput *pi);
+
+	void writeRun();
+	void writeVarint(uint32_t n);
+	uint32_t readVarint();
+};
+
+#endif // INPUT_LOG_H__
@@ -11,6 +11,7 @@
 #include "file.h"
 #include "fs.h"
 #include "game.h"
+#include "profiler.h"
 #include "scaler.h"
 #include "systemstub.h"
 #include "util.h"
@@ -27,6 +28,18 @@ static const char *USAGE =
 	"  --scaler=NAME@X   Graphics scaler (default 'scale@3')\n"
 	"  --language=LANG   Language (fr,en,de,sp,it,jp,ru)\n"
 	"  --autosave        Save game state automatically\n"
+	"  --headless        Run without display and sound device\n"
+	"  --frames=NUM      Quit after NUM frames (headless)\n"
+	"  --virtualtime     Pace frames with a virtual clock, never sleep\n"
+	"  --record=NAME     Record inputs to NAME in the save path\n"
+	"  --replay=NAME     Replay inputs recorded in NAME\n"
+	"  --profile=FILE    Dump frame phases timings as CSV\n"
+	"  --indexed         Keep the 8-bit screen, convert it to RGB on display\n"
+	"  --roomcache=KB    Memory used to keep the decoded rooms (default 1024)\n"
+	"  --audiorate=HZ    Sound output rate (default 22050)\n"
+	"  --audiobuffer=NUM Sound output buffer size in samples (default 2048)\n"
+	"  --voices=NUM      Sound effects played at the same time (default 4)\n"
+	"  --lowlatency      Use a 256 samples sound output buffer\n"
 ;
 
 static int detectVersion(FileSystem *fs) {
@@ -195,6 +208,18 @@ int main(int argc, char *argv[]) {
 	bool fullscreen = true;
 	bool autoSave = false;
 	bool useWrikeTShirt = false;
+	bool headless = false;
+	int maxFrames = 0;
+	bool virtualTime = false;
+	bool indexed = false;
+	int roomCacheSize = -1;
+	int audioSampleRate = 0;
+	int audioSamples = 0;
+	int voices = 0;
+	bool lowLatency = false;
+	const char *inputLogName = 0;
+	bool inputLogReplay = false;
+	const char *profilePath = 0;
 	WidescreenMode widescreen = kWidescreenNone;
 	ScalerParameters scalerParameters = ScalerParameters::defaults();
 	int forcedLanguage = -1;
@@ -217,6 +242,18 @@ int main(int argc, char *argv[]) {
 			{ "widescreen", required_argument, 0, 8  },
 			{ "autosave",   no_argument,       0, 9  },
 			{ "wrike",      no_argument,       0, 10 },
+			{ "headless",   no_argument,       0, 11 },
+			{ "frames",     required_argument, 0, 12 },
+			{ "virtualtime", no_argument,      0, 13 },
+			{ "record",     required_argument, 0, 14 },
+			{ "replay",     required_argument, 0, 15 },
+			{ "profile",    required_argument, 0, 16 },
+			{ "indexed",    no_argument,       0, 17 },
+			{ "roomcache",  required_argument, 0, 18 },
+			{ "audiorate",  required_argument, 0, 19 },
+			{ "audiobuffer", required_argument, 0, 20 },
+			{ "voices",     required_argument, 0, 21 },
+			{ "lowlatency", no_argument,       0, 22 },
 			{ 0, 0, 0, 0 }
 		};
 		int index;
@@ -274,6 +311,44 @@ int main(int argc, char *argv[]) {
 		case 10:
 			useWrikeTShirt = true;
 			break;
+		case 11:
+			headless = true;
+			break;
+		case 12:
+			maxFrames = atoi(optarg);
+			break;
+		case 13:
+			virtualTime = true;
+			break;
+		case 14:
+			inputLogName = strdup(optarg);
+			inputLogReplay = false;
+			break;
+		case 15:
+			inputLogName = strdup(optarg);
+			inputLogReplay = true;
+			break;
+		case 16:
+			profilePath = strdup(optarg);
+			break;
+		case 17:
+			indexed = true;
+			break;
+		case 18:
+			roomCacheSize = atoi(optarg);
+			break;
+		case 19:
+			audioSampleRate = atoi(optarg);
+			break;
+		case 20:
+			audioSamples = atoi(optarg);
+			break;
+		case 21:
+			voices = atoi(optarg);
+			break;
+		case 22:
+			lowLatency = true;
+			break;
 		default:
 			printf(USAGE, argv[0]);
 			return 0;
@@ -291,12 +366,30 @@ int main(int argc, char *argv[]) {
 		error("Unable to find data files, check that all required files are present");
 		return -1;
 	}
+	if (profilePath) {
+		g_profiler.enable(profilePath);
+	}
 	const Language language = (forcedLanguage == -1) ? detectLanguage(&fs) : (Language)forcedLanguage;
-	SystemStub *stub = SystemStub_SDL_create();
+	SystemStub *stub = headless ? SystemStub_Null_create(maxFrames) : SystemStub_SDL_create();
 	Game *g = new Game(stub, &fs, &tune_fs, savePath, levelNum, (ResourceType)version, language, widescreen, autoSave);
+	g->_inp_logName = inputLogName;
+	g->_inp_logReplay = inputLogReplay;
+	if (roomCacheSize >= 0) {
+		g->_vid._roomCache.setMaxSize(roomCacheSize * 1024);
+	}
+	if (voices > 0) {
+		g->_mix.setChannelsCount(voices);
+	}
 	stub->init(g_caption, g->_vid._w, g->_vid._h, fullscreen, widescreen, &scalerParameters);
+	stub->setVirtualTime(virtualTime);
+	stub->setIndexedPresentation(indexed);
+	if (lowLatency && audioSamples == 0) {
+		audioSamples = 256;
+	}
+	stub->setAudioParameters(audioSampleRate, audioSamples);
 	g->run();
 	delete g;
+	g_profiler.disable();
 	stub->destroy();
 	delete stub;
 	return 0;
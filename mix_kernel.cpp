@@ -0,0 +1,153 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#if defined(__SSE2__)
+#define MIX_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define MIX_NEON
+#include <arm_neon.h>
+#endif
+#include "intern.h"
+#include "mix_kernel.h"
+
+// the samples are fetched one by one, the volume, the 8 to 16 bits conversion and the
+// saturated addition are done on 8 samples at once. s * vol / div is computed with floats,
+// the quotient of the correctly rounded division truncates to the integer division result
+
+uint32_t mixSamplesS8(int16_t *dst, int count, const int8_t *src, uint32_t pos, uint32_t inc, int vol, int div) {
+	int i = 0;
+#if defined(MIX_SSE2)
+	const __m128 scale = _mm_set1_ps((float)vol);
+	const __m128 divisor = _mm_set1_ps((float)div);
+	const __m128i minS8 = _mm_set1_epi16(-128);
+	const __m128i maxS8 = _mm_set1_epi16(127);
+	const __m128i mul = _mm_set1_epi16(257);
+	const __m128i bias = _mm_set1_epi16(128);
+	for (; i + 8 <= count; i += 8) {
+		const int s0 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s1 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s2 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s3 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s4 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s5 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s6 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const int s7 = src[pos >> MIX_FRAC_BITS]; pos += inc;
+		const __m128 lo = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(s0, s1, s2, s3)), scale), divisor);
+		const __m128 hi = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(s4, s5, s6, s7)), scale), divisor);
+		__m128i q = _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+		q = _mm_min_epi16(_mm_max_epi16(q, minS8), maxS8);
+		// S8_to_S16, the intermediate product wraps for -128
+		q = _mm_add_epi16(_mm_mullo_epi16(q, mul), bias);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(dst + i)), q));
+	}
+#elif defined(MIX_NEON)
+	const float32x4_t scale = vdupq_n_f32((float)vol);
+	const float32x4_t divisor = vdupq_n_f32((float)div);
+	const int16x8_t minS8 = vdupq_n_s16(-128);
+	const int16x8_t maxS8 = vdupq_n_s16(127);
+	const int16x8_t bias = vdupq_n_s16(128);
+	for (; i + 8 <= count; i += 8) {
+		int32x4_t s0 = vdupq_n_s32(0);
+		int32x4_t s1 = vdupq_n_s32(0);
+		s0 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s0, 0); pos += inc;
+		s0 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s0, 1); pos += inc;
+		s0 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s0, 2); pos += inc;
+		s0 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s0, 3); pos += inc;
+		s1 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s1, 0); pos += inc;
+		s1 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s1, 1); pos += inc;
+		s1 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s1, 2); pos += inc;
+		s1 = vsetq_lane_s32(src[pos >> MIX_FRAC_BITS], s1, 3); pos += inc;
+		const float32x4_t lo = vdivq_f32(vmulq_f32(vcvtq_f32_s32(s0), scale), divisor);
+		const float32x4_t hi = vdivq_f32(vmulq_f32(vcvtq_f32_s32(s1), scale), divisor);
+		int16x8_t q = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(lo)), vqmovn_s32(vcvtq_s32_f32(hi)));
+		q = vminq_s16(vmaxq_s16(q, minS8), maxS8);
+		q = vaddq_s16(vmulq_n_s16(q, 257), bias);
+		vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), q));
+	}
+#endif
+	for (; i < count; ++i) {
+		const int sample = src[pos >> MIX_FRAC_BITS] * vol / div;
+		dst[i] = ADDC_S16(dst[i], S8_to_S16(sample));
+		pos += inc;
+	}
+	return pos;
+}
+
+void mixSamplesS16(int16_t *dst, int count, const int16_t *src, int vol) {
+	int i = 0;
+	if (vol >= 64) {
+#if defined(MIX_SSE2)
+		for (; i + 8 <= count; i += 8) {
+			const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(dst + i)), s));
+		}
+#elif defined(MIX_NEON)
+		for (; i + 8 <= count; i += 8) {
+			vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vld1q_s16(src + i)));
+		}
+#endif
+		for (; i < count; ++i) {
+			dst[i] = ADDC_S16(dst[i], src[i]);
+		}
+		return;
+	}
+#if defined(MIX_SSE2)
+	const __m128i v = _mm_set1_epi16(vol);
+	for (; i + 8 <= count; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		// 32 bits products
+		const __m128i lo = _mm_mullo_epi16(s, v);
+		const __m128i hi = _mm_mulhi_epi16(s, v);
+		const __m128i p0 = _mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 6);
+		const __m128i p1 = _mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 6);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(dst + i)), _mm_packs_epi32(p0, p1)));
+	}
+#elif defined(MIX_NEON)
+	const int16x4_t v = vdup_n_s16(vol);
+	for (; i + 8 <= count; i += 8) {
+		const int16x8_t s = vld1q_s16(src + i);
+		const int16x4_t p0 = vshrn_n_s32(vmull_s16(vget_low_s16(s), v), 6);
+		const int16x4_t p1 = vshrn_n_s32(vmull_s16(vget_high_s16(s), v), 6);
+		vst1q_s16(dst + i, vqaddq_s16(vld1q_s16(dst + i), vcombine_s16(p0, p1)));
+	}
+#endif
+	for (; i < count; ++i) {
+		dst[i] = ADDC_S16(dst[i], (src[i] * vol) >> 6);
+	}
+}
+
+void mixMonoToStereo(int16_t *dst, const int16_t *src, int count) {
+	int i = 0;
+#if defined(MIX_SSE2)
+	for (; i + 8 <= count; i += 8) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i *p = (__m128i *)(dst + i * 2);
+		_mm_storeu_si128(p,     _mm_adds_epi16(_mm_loadu_si128(p),     _mm_unpacklo_epi16(s, s)));
+		_mm_storeu_si128(p + 1, _mm_adds_epi16(_mm_loadu_si128(p + 1), _mm_unpackhi_epi16(s, s)));
+	}
+#elif defined(MIX_NEON)
+	for (; i + 8 <= count; i += 8) {
+		const int16x8_t s = vld1q_s16(src + i);
+		int16x8x2_t d = vld2q_s16(dst + i * 2);
+		d.val[0] = vqaddq_s16(d.val[0], s);
+		d.val[1] = vqaddq_s16(d.val[1], s);
+		vst2q_s16(dst + i * 2, d);
+	}
+#endif
+	for (; i < count; ++i) {
+		dst[i * 2]     = ADDC_S16(dst[i * 2], src[i]);
+		dst[i * 2 + 1] = ADDC_S16(dst[i * 2 + 1], src[i]);
+	}
+}
+
+void monoToStereo(int16_t *buf, int count) {
+	// backwards, the stereo frames overlap the mono samples not converted yet
+	for (int i = count - 1; i >= 0; --i) {
+		buf[i * 2] = buf[i * 2 + 1] = buf[i];
+	}
+}
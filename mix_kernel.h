@@ -0,0 +1,26 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef MIX_KERNEL_H__
+#define MIX_KERNEL_H__
+
+#include <stdint.h>
+
+enum {
+	MIX_FRAC_BITS = 12
+};
+
+// adds 'count' samples of 'src' read every 'inc' from 'pos' (fixed point), scaled by vol/div and saturated ;
+// the caller ensures the positions stay within 'src', returns the position after the last sample
+uint32_t mixSamplesS8(int16_t *dst, int count, const int8_t *src, uint32_t pos, uint32_t inc, int vol, int div);
+// adds 'count' samples of 'src' scaled by vol/64 with saturation, a straight addition at full volume
+void mixSamplesS16(int16_t *dst, int count, const int16_t *src, int vol);
+// adds the 'count' mono samples of 'src' to both channels of 'dst' with saturation
+void mixMonoToStereo(int16_t *dst, const int16_t *src, int count);
+// converts in place the 'count' mono samples at the start of 'buf' to stereo frames
+void monoToStereo(int16_t *buf, int count);
+
+#endif // MIX_KERNEL_H__
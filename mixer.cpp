@@ -5,17 +5,30 @@
  */
 
 #include "mixer.h"
+#include "resampler.h"
 #include "systemstub.h"
 #include "util.h"
 
 Mixer::Mixer(FileSystem *fs, SystemStub *stub)
-	: _stub(stub), _musicType(MT_NONE), _cpc(this, fs), _mod(this, fs), _ogg(this, fs), _sfx(this) {
+	: _stub(stub), _channelsCount(NUM_CHANNELS), _sfxList(0), _sfxCount(0), _musicType(MT_NONE), _cpc(this, fs), _mod(this, fs), _ogg(this, fs), _sfx(this) {
 	_musicTrack = -1;
 	_backgroundMusicType = MT_NONE;
 }
 
+void Mixer::setChannelsCount(int count) {
+	_channelsCount = CLIP(count, 1, (int)MAX_CHANNELS);
+}
+
 void Mixer::init() {
 	memset(_channels, 0, sizeof(_channels));
+	_channelsCounter = 0;
+	_voicesStolen.store(0);
+	_voicesDropped.store(0);
+	_commandsHead.store(0);
+	_commandsTail.store(0);
+	for (int i = 0; i < MAX_CHANNELS; ++i) {
+		_channelsData[i].store(0);
+	}
 	_premixHook = 0;
 	_stub->startAudio(Mixer::mixCallback, this);
 }
@@ -23,7 +36,9 @@ void Mixer::init() {
 void Mixer::free() {
 	setPremixHook(0, 0);
 	stopAll();
+	freeSfx();
 	_stub->stopAudio();
+	debug(DBG_INFO, "Mixer %d voices, %d stolen, %d dropped", _channelsCount, _voicesStolen.load(), _voicesDropped.load());
 }
 
 void Mixer::setPremixHook(PremixHook premixHook, void *userData) {
@@ -35,36 +50,119 @@ void Mixer::setPremixHook(PremixHook premixHook, void *userData) {
 
 void Mixer::play(const uint8_t *data, uint32_t len, uint16_t freq, uint8_t volume) {
 	debug(DBG_SND, "Mixer::play(%d, %d)", freq, volume);
-	LockAudioStack las(_stub);
-	MixerChannel *ch = 0;
-	for (int i = 0; i < NUM_CHANNELS; ++i) {
-		MixerChannel *cur = &_channels[i];
-		if (cur->active) {
-			if (cur->chunk.data == data) {
-				cur->chunkPos = 0;
-				return;
-			}
-		} else {
-			ch = cur;
-			break;
+	queueCommand(data, len, (freq << FRAC_BITS) / _stub->getOutputSampleRate(), 0, volume);
+}
+
+struct SfxReader {
+	const int8_t *data;
+	int len;
+	int pos;
+
+	static int readSamples(void *userData, int16_t *buf, int frames) {
+		SfxReader *sr = (SfxReader *)userData;
+		const int count = MIN(frames, sr->len - sr->pos);
+		for (int i = 0; i < count; ++i) {
+			buf[i] = S8_to_S16(sr->data[sr->pos + i]);
+		}
+		sr->pos += count;
+		return count;
+	}
+};
+
+void Mixer::loadSfx(const SoundFx *sfxList, int count) {
+	debug(DBG_SND, "Mixer::loadSfx(%d)", count);
+	// the channels may be playing the previous samples
+	stopAll();
+	freeSfx();
+	_sfxList = (MixerSfx *)calloc(count, sizeof(MixerSfx));
+	if (!_sfxList) {
+		warning("Unable to allocate %d sound effects", count);
+		return;
+	}
+	_sfxCount = count;
+	Resampler *resampler = (Resampler *)malloc(sizeof(Resampler));
+	if (!resampler) {
+		warning("Unable to allocate sound effects resampler");
+		return;
+	}
+	const uint32_t rate = _stub->getOutputSampleRate();
+	for (int i = 0; i < count; ++i) {
+		const SoundFx *sfx = &sfxList[i];
+		if (!sfx->data || sfx->len < 2 || sfx->freq == 0) {
+			continue;
+		}
+		// the last sample of the chunk is not played
+		const uint32_t len = ((uint64_t)(sfx->len - 1) * rate + sfx->freq - 1) / sfx->freq;
+		int16_t *samples = (int16_t *)calloc(len * 2, sizeof(int16_t));
+		if (!samples) {
+			warning("Unable to allocate %d samples for sound effect %d", len, i);
+			continue;
+		}
+		SfxReader sr;
+		sr.data = (const int8_t *)sfx->data;
+		sr.len = sfx->len;
+		sr.pos = 0;
+		resampler->init(1, sfx->freq, rate);
+		resampler->mix(samples, len, SfxReader::readSamples, &sr);
+		// keep one channel of the stereo frames
+		for (uint32_t j = 0; j < len; ++j) {
+			samples[j] = samples[j * 2];
 		}
+		MixerSfx *ms = &_sfxList[i];
+		ms->data = sfx->data;
+		int16_t *shrunk = (int16_t *)realloc(samples, len * sizeof(int16_t));
+		ms->samples = shrunk ? shrunk : samples;
+		ms->len = len;
 	}
-	if (ch) {
-		ch->active = true;
-		ch->volume = volume;
-		ch->chunk.data = data;
-		ch->chunk.len = len;
-		ch->chunkPos = 0;
-		ch->chunkInc = (freq << FRAC_BITS) / _stub->getOutputSampleRate();
+	::free(resampler);
+}
+
+void Mixer::freeSfx() {
+	for (int i = 0; i < _sfxCount; ++i) {
+		::free(_sfxList[i].samples);
+	}
+	::free(_sfxList);
+	_sfxList = 0;
+	_sfxCount = 0;
+}
+
+// the samples are converted at full volume, the script volume (softVol) is applied when mixing ;
+// it varies between the plays of an effect and keeping one copy per level would quadruple the cache
+void Mixer::playSfx(int num, uint8_t volume) {
+	debug(DBG_SND, "Mixer::playSfx(%d, %d)", num, volume);
+	if (num < _sfxCount && _sfxList[num].samples) {
+		const MixerSfx *ms = &_sfxList[num];
+		queueCommand(ms->data, ms->len, 0, ms->samples, volume);
+	}
+}
+
+void Mixer::queueCommand(const uint8_t *data, uint32_t len, uint32_t chunkInc, const int16_t *samples, uint8_t volume) {
+	const uint32_t head = _commandsHead.load(std::memory_order_relaxed);
+	if (head - _commandsTail.load(std::memory_order_acquire) >= NUM_COMMANDS) {
+		warning("Mixer::queueCommand() commands queue is full");
+		return;
 	}
+	MixerCommand *cmd = &_commands[head & (NUM_COMMANDS - 1)];
+	cmd->data = data;
+	cmd->len = len;
+	cmd->chunkInc = chunkInc;
+	cmd->samples = samples;
+	cmd->volume = volume;
+	_commandsHead.store(head + 1, std::memory_order_release);
 }
 
 bool Mixer::isPlaying(const uint8_t *data) const {
 	debug(DBG_SND, "Mixer::isPlaying");
-	LockAudioStack las(_stub);
-	for (int i = 0; i < NUM_CHANNELS; ++i) {
-		const MixerChannel *ch = &_channels[i];
-		if (ch->active && ch->chunk.data == data) {
+	// the channels of the processed commands are published before the tail
+	const uint32_t tail = _commandsTail.load(std::memory_order_acquire);
+	const uint32_t head = _commandsHead.load(std::memory_order_relaxed);
+	for (uint32_t i = tail; i != head; ++i) {
+		if (_commands[i & (NUM_COMMANDS - 1)].data == data) {
+			return true;
+		}
+	}
+	for (int i = 0; i < _channelsCount; ++i) {
+		if (_channelsData[i].load(std::memory_order_acquire) == data) {
 			return true;
 		}
 	}
@@ -77,9 +175,13 @@ uint32_t Mixer::getSampleRate() const {
 
 void Mixer::stopAll() {
 	debug(DBG_SND, "Mixer::stopAll()");
+	// the caller may free the samples on return, wait for the audio callback
 	LockAudioStack las(_stub);
-	for (uint8_t i = 0; i < NUM_CHANNELS; ++i) {
+	_commandsTail.store(_commandsHead.load());
+	for (int i = 0; i < _channelsCount; ++i) {
 		_channels[i].active = false;
+		_channels[i].fadeOut = 0;
+		_channelsData[i].store(0);
 	}
 }
 
@@ -167,34 +269,139 @@ void Mixer::stopMusic() {
 static const bool kUseNr = false;
 
 static void nr(int16_t *buf, int len) {
-	static int prev = 0;
-	for (int i = 0; i < len; ++i) {
+	static int prev[2] = { 0, 0 };
+	for (int i = 0; i < len * 2; ++i) {
 		const int vnr = buf[i] >> 1;
-		buf[i] = vnr + prev;
-		prev = vnr;
+		buf[i] = vnr + prev[i & 1];
+		prev[i & 1] = vnr;
+	}
+}
+
+void Mixer::startChannel(MixerChannel *ch, const MixerCommand *cmd) {
+	ch->active = true;
+	ch->volume = cmd->volume;
+	ch->chunk.data = cmd->data;
+	ch->chunk.len = cmd->len;
+	ch->chunkPos = 0;
+	ch->chunkInc = cmd->chunkInc;
+	ch->samples = cmd->samples;
+	ch->startCounter = _channelsCounter++;
+}
+
+void Mixer::processCommands() {
+	const uint32_t head = _commandsHead.load(std::memory_order_acquire);
+	uint32_t tail = _commandsTail.load(std::memory_order_relaxed);
+	for (; tail != head; ++tail) {
+		const MixerCommand *cmd = &_commands[tail & (NUM_COMMANDS - 1)];
+		MixerChannel *freeChannel = 0;
+		MixerChannel *stolenChannel = 0;
+		bool restarted = false;
+		for (int i = 0; i < _channelsCount; ++i) {
+			MixerChannel *cur = &_channels[i];
+			if (!cur->active) {
+				if (!freeChannel) {
+					freeChannel = cur;
+				}
+			} else if (cur->fadeOut != 0) {
+				// the command replacing the stolen voice is started after the fade
+				if (cur->next.data == cmd->data) {
+					restarted = true;
+					break;
+				}
+			} else if (cur->chunk.data == cmd->data) {
+				cur->chunkPos = 0;
+				restarted = true;
+				break;
+			} else if (!stolenChannel || cur->volume < stolenChannel->volume || (cur->volume == stolenChannel->volume && (int32_t)(cur->startCounter - stolenChannel->startCounter) < 0)) {
+				// the quietest voice, the oldest one first
+				stolenChannel = cur;
+			}
+		}
+		if (restarted) {
+			continue;
+		}
+		if (freeChannel) {
+			startChannel(freeChannel, cmd);
+			_channelsData[freeChannel - _channels].store(cmd->data, std::memory_order_relaxed);
+		} else if (stolenChannel && stolenChannel->volume <= cmd->volume) {
+			stolenChannel->fadeOut = FADE_OUT_SAMPLES;
+			stolenChannel->next = *cmd;
+			_channelsData[stolenChannel - _channels].store(cmd->data, std::memory_order_relaxed);
+			_voicesStolen.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			_voicesDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	_commandsTail.store(tail, std::memory_order_release);
+}
+
+// returns the number of samples mixed, less than 'samples' when the channel ends
+int Mixer::mixChannel(MixerChannel *ch, int16_t *buf, int samples) {
+	int count = 0;
+	if (ch->samples) {
+		count = MIN<uint32_t>(samples, ch->chunk.len - ch->chunkPos);
+		mixSamplesS16(buf, count, ch->samples + ch->chunkPos, ch->volume);
+		ch->chunkPos += count;
+	} else {
+		// the last sample of the chunk is not played
+		const uint32_t end = (ch->chunk.len < 2) ? 0 : (ch->chunk.len - 1) << FRAC_BITS;
+		if (ch->chunkPos < end) {
+			count = MIN<uint32_t>(samples, (end - ch->chunkPos - 1) / ch->chunkInc + 1);
+			ch->chunkPos = mixSamplesS8(buf, count, (const int8_t *)ch->chunk.data, ch->chunkPos, ch->chunkInc, ch->volume, Mixer::MAX_VOLUME);
+		}
 	}
+	return count;
 }
 
 void Mixer::mix(int16_t *out, int len) {
+	processCommands();
 	if (_premixHook) {
 		if (!_premixHook(_premixHookData, out, len)) {
 			_premixHook = 0;
 			_premixHookData = 0;
 		}
 	}
-	for (uint8_t i = 0; i < NUM_CHANNELS; ++i) {
-		MixerChannel *ch = &_channels[i];
-		if (ch->active) {
-			for (int pos = 0; pos < len; ++pos) {
-				if ((ch->chunkPos >> FRAC_BITS) >= (ch->chunk.len - 1)) {
+	// the sound effects are mono, all the voices are mixed in a block kept in the cache,
+	// the block is then added to both channels
+	int16_t buf[MONO_BUFFER_SIZE];
+	int16_t fadeBuf[FADE_OUT_SAMPLES];
+	for (int offset = 0; offset < len; offset += MONO_BUFFER_SIZE) {
+		const int samples = MIN(len - offset, (int)MONO_BUFFER_SIZE);
+		bool mixed = false;
+		for (int i = 0; i < _channelsCount; ++i) {
+			MixerChannel *ch = &_channels[i];
+			if (ch->active) {
+				if (!mixed) {
+					memset(buf, 0, samples * sizeof(int16_t));
+					mixed = true;
+				}
+				int pos = 0;
+				if (ch->fadeOut != 0) {
+					// linear ramp down of the stolen voice
+					const int fadeLen = MIN(samples, ch->fadeOut);
+					memset(fadeBuf, 0, fadeLen * sizeof(int16_t));
+					const int count = mixChannel(ch, fadeBuf, fadeLen);
+					for (int j = 0; j < count; ++j) {
+						buf[j] = ADDC_S16(buf[j], fadeBuf[j] * (ch->fadeOut - j) / FADE_OUT_SAMPLES);
+					}
+					ch->fadeOut -= fadeLen;
+					if (ch->fadeOut != 0 && count == fadeLen) {
+						continue;
+					}
+					ch->fadeOut = 0;
+					startChannel(ch, &ch->next);
+					pos = fadeLen;
+				}
+				const int count = mixChannel(ch, buf + pos, samples - pos);
+				if (count < samples - pos) {
 					ch->active = false;
-					break;
+					_channelsData[i].store(0, std::memory_order_release);
 				}
-				const int sample = ch->chunk.getPCM(ch->chunkPos >> FRAC_BITS) * ch->volume / Mixer::MAX_VOLUME;
-				out[pos] = ADDC_S16(out[pos], S8_to_S16(sample));
-				ch->chunkPos += ch->chunkInc;
 			}
 		}
+		if (mixed) {
+			mixMonoToStereo(out + offset * 2, buf, samples);
+		}
 	}
 	if (kUseNr) {
 		nr(out, len);
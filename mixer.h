@@ -7,8 +7,10 @@
 #ifndef MIXER_H__
 #define MIXER_H__
 
+#include <atomic>
 #include "intern.h"
 #include "cpc_player.h"
+#include "mix_kernel.h"
 #include "mod_player.h"
 #include "ogg_player.h"
 #include "sfx_player.h"
@@ -20,15 +22,15 @@ struct MixerChunk {
 	MixerChunk()
 		: data(0), len(0) {
 	}
+};
 
-	int8_t getPCM(int offset) const {
-		if (offset < 0) {
-			offset = 0;
-		} else if (offset >= (int)len) {
-			offset = len - 1;
-		}
-		return (int8_t)data[offset];
-	}
+// queued by the game thread, picked up by Mixer::mix
+struct MixerCommand {
+	const uint8_t *data;
+	uint32_t len;
+	uint32_t chunkInc;
+	const int16_t *samples;
+	uint8_t volume;
 };
 
 struct MixerChannel {
@@ -37,13 +39,24 @@ struct MixerChannel {
 	MixerChunk chunk;
 	uint32_t chunkPos;
 	uint32_t chunkInc;
+	const int16_t *samples; // converted sound effect, 'chunkPos' is then the sample index
+	uint32_t startCounter; // age of the voice, for stealing
+	int fadeOut; // samples left before 'next' replaces the stolen voice
+	MixerCommand next;
+};
+
+// sound effect converted to 16 bits at the output rate when the level is loaded
+struct MixerSfx {
+	const uint8_t *data; // SoundFx data, identifies the sound for isPlaying
+	int16_t *samples;
+	uint32_t len;
 };
 
 struct FileSystem;
 struct SystemStub;
 
 struct Mixer {
-	typedef bool (*PremixHook)(void *userData, int16_t *buf, int len);
+	typedef bool (*PremixHook)(void *userData, int16_t *buf, int len); // 'len' stereo frames
 
 	enum MusicType {
 		MT_NONE,
@@ -56,13 +69,27 @@ struct Mixer {
 	enum {
 		MUSIC_TRACK = 1000,
 		NUM_CHANNELS = 4,
-		FRAC_BITS = 12,
+		MAX_CHANNELS = 32,
+		FADE_OUT_SAMPLES = 128,
+		NUM_COMMANDS = 32, // power of 2
+		MONO_BUFFER_SIZE = 512,
+		FRAC_BITS = MIX_FRAC_BITS,
 		MAX_VOLUME = 64
 	};
 
 	FileSystem *_fs;
 	SystemStub *_stub;
-	MixerChannel _channels[NUM_CHANNELS];
+	int _channelsCount;
+	MixerChannel _channels[MAX_CHANNELS];
+	uint32_t _channelsCounter;
+	std::atomic<uint32_t> _voicesStolen;
+	std::atomic<uint32_t> _voicesDropped;
+	MixerCommand _commands[NUM_COMMANDS];
+	std::atomic<uint32_t> _commandsHead; // written by the game thread
+	std::atomic<uint32_t> _commandsTail; // written by the audio thread
+	std::atomic<const uint8_t *> _channelsData[MAX_CHANNELS]; // playing chunks, for isPlaying
+	MixerSfx *_sfxList;
+	int _sfxCount;
 	PremixHook _premixHook;
 	void *_premixHookData;
 	MusicType _backgroundMusicType;
@@ -74,16 +101,24 @@ struct Mixer {
 	int _musicTrack;
 
 	Mixer(FileSystem *fs, SystemStub *stub);
+	void setChannelsCount(int count);
 	void init();
 	void free();
 	void setPremixHook(PremixHook premixHook, void *userData);
 	void play(const uint8_t *data, uint32_t len, uint16_t freq, uint8_t volume);
+	void loadSfx(const SoundFx *sfxList, int count);
+	void freeSfx();
+	void playSfx(int num, uint8_t volume);
+	void queueCommand(const uint8_t *data, uint32_t len, uint32_t chunkInc, const int16_t *samples, uint8_t volume);
 	bool isPlaying(const uint8_t *data) const;
 	uint32_t getSampleRate() const;
 	void stopAll();
 	void playMusic(int num);
 	void stopMusic();
-	void mix(int16_t *buf, int len);
+	void processCommands();
+	void startChannel(MixerChannel *ch, const MixerCommand *cmd);
+	int mixChannel(MixerChannel *ch, int16_t *buf, int samples);
+	void mix(int16_t *buf, int len); // 'len' stereo frames
 
 	static void mixCallback(void *param, int16_t *buf, int len);
 };
@@ -5,6 +5,7 @@
  */
 
 #include "file.h"
+#include "mix_kernel.h"
 #include "mixer.h"
 #include "mod_player.h"
 #include "util.h"
@@ -26,7 +27,7 @@ struct ModPlayer_impl {
 		memset(&_settings, 0, sizeof(_settings));
 		ModPlug_GetSettings(&_settings);
 		_settings.mFlags = MODPLUG_ENABLE_OVERSAMPLING | MODPLUG_ENABLE_NOISE_REDUCTION;
-		_settings.mChannels = 1;
+		_settings.mChannels = 2;
 		_settings.mBits = 16;
 		_settings.mFrequency = rate;
 		_settings.mResamplingMode = MODPLUG_RESAMPLE_FIR;
@@ -58,7 +59,7 @@ struct ModPlayer_impl {
 				ModPlug_SeekOrder(_mf, 1);
 				_repeatIntro = false;
 			}
-			const int count = ModPlug_Read(_mf, buf, len * sizeof(int16_t));
+			const int count = ModPlug_Read(_mf, buf, len * 2 * sizeof(int16_t));
 			// setting mLoopCount to non-zero does not trigger any looping in
 			// my test and ModPlug_Read returns 0.
 			// looking at the libmodplug-0.8.8 tarball, it seems the variable
@@ -71,6 +72,20 @@ struct ModPlayer_impl {
 		}
 		return false;
 	}
+
+	int mixPass(int16_t *buf, int len) {
+		const int order = ModPlug_GetCurrentOrder(_mf);
+		if (order == 3 && _repeatIntro) {
+			ModPlug_SeekOrder(_mf, 1);
+			_repeatIntro = false;
+		}
+		const int count = ModPlug_Read(_mf, buf, len * 2 * sizeof(int16_t)) / (2 * sizeof(int16_t));
+		if (count < len) {
+			// end of the song, the next call starts a new pass
+			ModPlug_SeekOrder(_mf, 0);
+		}
+		return count;
+	}
 };
 
 #else
@@ -80,7 +95,7 @@ struct ModPlayer_impl {
 		NUM_SAMPLES = 31,
 		NUM_TRACKS = 4,
 		NUM_PATTERNS = 128,
-		FRAC_BITS = 12,
+		FRAC_BITS = MIX_FRAC_BITS,
 		PAULA_FREQ = 3546897
 	};
 
@@ -92,15 +107,6 @@ struct ModPlayer_impl {
 		uint16_t repeatPos;
 		uint16_t repeatLen;
 		int8_t *data;
-
-		int8_t getPCM(int offset) const {
-			if (offset < 0) {
-				offset = 0;
-			} else if (offset >= (int)len) {
-				offset = len - 1;
-			}
-			return data[offset];
-		}
 	};
 
 	struct ModuleInfo {
@@ -142,6 +148,7 @@ struct ModPlayer_impl {
 	int _patternLoopCount;
 	int _samplesLeft;
 	bool _repeatIntro;
+	int _passTicks;
 	Track _tracks[NUM_TRACKS];
 
 	ModPlayer_impl();
@@ -158,6 +165,7 @@ struct ModPlayer_impl {
 	void handleEffect(int trackNum, bool tick);
 	void mixSamples(int16_t *buf, int len);
 	bool mix(int16_t *buf, int len);
+	int mixPass(int16_t *buf, int len);
 };
 
 ModPlayer_impl::ModPlayer_impl()
@@ -238,6 +246,7 @@ bool ModPlayer_impl::load(File *f) {
 	_patternLoopCount = -1;
 	_samplesLeft = 0;
 	_repeatIntro = false;
+	_passTicks = 0;
 	memset(_tracks, 0, sizeof(_tracks));
 	_playing = true;
 
@@ -614,11 +623,9 @@ void ModPlayer_impl::mixSamples(int16_t *buf, int samplesLen) {
 					}
 					curLen = 0;
 				}
-				while (count--) {
-					const int out = si->getPCM(pos >> FRAC_BITS) * tk->volume / 64;
-					*mixbuf = ADDC_S16(*mixbuf, S8_to_S16(out));
-					++mixbuf;
-					pos += deltaPos;
+				if (count > 0) {
+					pos = mixSamplesS8(mixbuf, count, si->data, pos, deltaPos, tk->volume, 64);
+					mixbuf += count;
 				}
 			}
 			tk->pos = pos;
@@ -627,46 +634,91 @@ void ModPlayer_impl::mixSamples(int16_t *buf, int samplesLen) {
 }
 
 bool ModPlayer_impl::mix(int16_t *buf, int len) {
-	memset(buf, 0, sizeof(int16_t) * len);
+	memset(buf, 0, sizeof(int16_t) * len * 2);
 	if (_playing) {
 		const int samplesPerTick = _mixingRate / (50 * _songTempo / 125);
-		while (len != 0) {
+		// mono samples, converted to stereo frames once mixed
+		int16_t *p = buf;
+		int samples = len;
+		while (samples != 0) {
 			if (_samplesLeft == 0) {
 				handleTick();
 				_samplesLeft = samplesPerTick;
 			}
 			int count = _samplesLeft;
-			if (count > len) {
-				count = len;
+			if (count > samples) {
+				count = samples;
 			}
 			_samplesLeft -= count;
-			len -= count;
-			mixSamples(buf, count);
-			buf += count;
+			samples -= count;
+			mixSamples(p, count);
+			p += count;
 		}
+		monoToStereo(buf, len);
 	}
 	return _playing;
 }
+
+int ModPlayer_impl::mixPass(int16_t *buf, int len) {
+	memset(buf, 0, sizeof(int16_t) * len * 2);
+	const int samplesPerTick = _mixingRate / (50 * _songTempo / 125);
+	int16_t *p = buf;
+	int samples = len;
+	while (samples != 0) {
+		if (_samplesLeft == 0) {
+			// a pass ends when the first row of the song is reached again
+			if (_currentTick == 0 && _currentPatternOrder == 0 && _currentPatternPos == 0 && _passTicks != 0) {
+				_passTicks = 0;
+				break;
+			}
+			handleTick();
+			++_passTicks;
+			_samplesLeft = samplesPerTick;
+		}
+		const int count = MIN(_samplesLeft, samples);
+		_samplesLeft -= count;
+		samples -= count;
+		mixSamples(p, count);
+		p += count;
+	}
+	monoToStereo(buf, len - samples);
+	return len - samples;
+}
 #endif
 
 ModPlayer::ModPlayer(Mixer *mixer, FileSystem *fs)
-	: _playing(false), _mix(mixer), _fs(fs) {
+	: _playing(false), _mix(mixer), _fs(fs), _pcm(0), _pcmSize(0), _pcmNum(-1) {
 	_impl = new ModPlayer_impl;
 }
 
 ModPlayer::~ModPlayer() {
+	stopRender();
+	free(_pcm);
 	delete _impl;
 }
 
 void ModPlayer::play(int num) {
 	if (num < _modulesFilesCount) {
+		stop();
+		if (num == _pcmNum && _pcmLoopEnd.load() != 0) {
+			// already rendered
+			_pcmPos = 0;
+			_mix->setPremixHook(mixPcmCallback, this);
+			_playing = true;
+			return;
+		}
+		stopRender();
 		File f;
 		for (uint8_t i = 0; i < ARRAYSIZE(_modulesFiles[num]); ++i) {
 			if (f.open(_modulesFiles[num][i], "rb", _fs)) {
 				_impl->init(_mix->getSampleRate());
 				if (_impl->load(&f)) {
 					_impl->_repeatIntro = (num == 0) && !_isAmiga;
-					_mix->setPremixHook(mixCallback, _impl);
+					if (startRender(num)) {
+						_mix->setPremixHook(mixPcmCallback, this);
+					} else {
+						_mix->setPremixHook(mixCallback, _impl);
+					}
 					_playing = true;
 				}
 				return;
@@ -678,11 +730,117 @@ void ModPlayer::play(int num) {
 void ModPlayer::stop() {
 	if (_playing) {
 		_mix->setPremixHook(0, 0);
-		_impl->unload();
+		if (_pcmNum == -1) {
+			_impl->unload();
+		}
 		_playing = false;
 	}
 }
 
+bool ModPlayer::startRender(int num) {
+	const uint32_t size = _mix->getSampleRate() * kMaxRenderSeconds;
+	if (size != _pcmSize) {
+		free(_pcm);
+		_pcm = (int16_t *)malloc(size * 2 * sizeof(int16_t));
+		_pcmSize = _pcm ? size : 0;
+		if (!_pcm) {
+			warning("Unable to allocate %d frames to render the module", size);
+			// the previous rendering is lost, play the module from the live path
+			_pcmNum = -1;
+			_pcmLoopEnd.store(0);
+			return false;
+		}
+	}
+	_pcmNum = num;
+	_pcmPos = 0;
+	_pcmFrames.store(0);
+	_pcmLoopStart = 0;
+	_pcmLoopEnd.store(0);
+	// the introduction is longer on PC, loop the second pass
+	_renderLoopPass = _impl->_repeatIntro ? 1 : 0;
+	_renderPasses = 0;
+	_renderPassStart = 0;
+	_renderStop = false;
+	// have some frames ready for the first callback
+	for (int i = 0; i < 4 && renderFrames(); ++i) {
+	}
+	_renderThread = std::thread(&ModPlayer::render, this);
+	return true;
+}
+
+void ModPlayer::stopRender() {
+	if (_renderThread.joinable()) {
+		_renderStop = true;
+		_renderThread.join();
+		if (_pcmLoopEnd.load() == 0) {
+			// incomplete
+			_pcmNum = -1;
+		}
+	}
+	_impl->unload();
+}
+
+bool ModPlayer::renderFrames() {
+	const uint32_t frames = _pcmFrames.load(std::memory_order_relaxed);
+	if (frames == _pcmSize) {
+		// too long, loop what was rendered
+		_pcmLoopStart = (_renderPasses == _renderLoopPass && _renderPassStart < frames) ? _renderPassStart : 0;
+		_pcmLoopEnd.store(frames, std::memory_order_release);
+		return false;
+	}
+	const int len = MIN<uint32_t>(kRenderFrames, _pcmSize - frames);
+	const int count = _impl->mixPass(_pcm + frames * 2, len);
+	_pcmFrames.store(frames + count, std::memory_order_release);
+	if (count < len) {
+		const uint32_t passEnd = frames + count;
+		if (_renderPasses == _renderLoopPass) {
+			if (passEnd > _renderPassStart) {
+				_pcmLoopStart = _renderPassStart;
+				_pcmLoopEnd.store(passEnd, std::memory_order_release);
+				return false;
+			}
+		} else {
+			++_renderPasses;
+		}
+		_renderPassStart = passEnd;
+	}
+	return true;
+}
+
+void ModPlayer::render() {
+	while (!_renderStop && renderFrames()) {
+	}
+	if (!_renderStop) {
+		_impl->unload();
+	}
+	debug(DBG_MOD, "ModPlayer::render() module %d frames %d loop %d,%d", _pcmNum, _pcmFrames.load(), _pcmLoopStart, _pcmLoopEnd.load());
+}
+
+bool ModPlayer::mixPcm(int16_t *buf, int len) {
+	while (len > 0) {
+		const uint32_t loopEnd = _pcmLoopEnd.load(std::memory_order_acquire);
+		if (loopEnd != 0 && _pcmPos >= loopEnd) {
+			_pcmPos = _pcmLoopStart;
+		}
+		const uint32_t end = (loopEnd != 0) ? loopEnd : _pcmFrames.load(std::memory_order_acquire);
+		const int count = MIN<uint32_t>(len, end - _pcmPos);
+		if (count == 0) {
+			// not rendered yet
+			memset(buf, 0, len * 2 * sizeof(int16_t));
+			break;
+		}
+		memcpy(buf, _pcm + _pcmPos * 2, count * 2 * sizeof(int16_t));
+		_pcmPos += count;
+		buf += count * 2;
+		len -= count;
+	}
+	return true;
+}
+
+bool ModPlayer::mixPcmCallback(void *param, int16_t *buf, int len) {
+	return ((ModPlayer *)param)->mixPcm(buf, len);
+}
+
 bool ModPlayer::mixCallback(void *param, int16_t *buf, int len) {
 	return ((ModPlayer_impl *)param)->mix(buf, len);
 }
@@ -7,14 +7,22 @@
 #ifndef MOD_PLAYER_H__
 #define MOD_PLAYER_H__
 
+#include <atomic>
+#include <thread>
 #include "intern.h"
 
 struct FileSystem;
 struct Mixer;
 struct ModPlayer_impl;
 
+// the modules are rendered by a thread when played, the audio callback then copies the frames
 struct ModPlayer {
 
+	enum {
+		kMaxRenderSeconds = 240,
+		kRenderFrames = 4096
+	};
+
 	static const uint16_t _periodTable[];
 	static const char *_modulesFiles[][2];
 	static const int _modulesFilesCount;
@@ -24,6 +32,18 @@ struct ModPlayer {
 	Mixer *_mix;
         FileSystem *_fs;
 	ModPlayer_impl *_impl;
+	int16_t *_pcm; // stereo frames
+	uint32_t _pcmSize;
+	int _pcmNum; // module in _pcm, -1 if none
+	uint32_t _pcmPos;
+	std::atomic<uint32_t> _pcmFrames;
+	uint32_t _pcmLoopStart;
+	std::atomic<uint32_t> _pcmLoopEnd; // set once the module is rendered
+	int _renderLoopPass;
+	int _renderPasses;
+	uint32_t _renderPassStart;
+	std::atomic<bool> _renderStop;
+	std::thread _renderThread;
 
         ModPlayer(Mixer *mixer, FileSystem *fs);
 	~ModPlayer();
@@ -31,6 +51,13 @@ struct ModPlayer {
 	void play(int num);
 	void stop();
 
+	bool startRender(int num);
+	void stopRender();
+	bool renderFrames();
+	void render();
+	bool mixPcm(int16_t *buf, int len);
+
+	static bool mixPcmCallback(void *param, int16_t *buf, int len);
 	static bool mixCallback(void *param, int16_t *buf, int len);
 };
 
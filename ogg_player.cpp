@@ -6,10 +6,14 @@
 
 #ifdef USE_TREMOR
 #include <tremor/ivorbisfile.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #endif
 #include "file.h"
 #include "mixer.h"
 #include "ogg_player.h"
+#include "resampler.h"
 #include "util.h"
 
 #ifdef USE_TREMOR
@@ -55,13 +59,23 @@ struct VorbisFile: File {
 	}
 };
 
+// the track is decoded by a thread into a ring buffer, the audio callback only copies the frames
 struct OggDecoder_impl {
+	enum {
+		kRingFrames = 1 << 15, // ~0.7 second at 44.1kHz
+		kDecodeFrames = 2048,
+		kDecodeSleepMs = 10
+	};
+
 	OggDecoder_impl()
-		: _open(false), _readBuf(0), _readBufSize(0) {
+		: _open(false), _ring(0), _ringHead(0), _ringTail(0), _stop(false), _error(false) {
 	}
 	~OggDecoder_impl() {
-		free(_readBuf);
-		_readBuf = 0;
+		if (_thread.joinable()) {
+			_stop = true;
+			_thread.join();
+		}
+		free(_ring);
 		if (_open) {
 			ov_clear(&_ovf);
 		}
@@ -79,63 +93,95 @@ struct OggDecoder_impl {
 		}
 		_open = true;
 		vorbis_info *vi = ov_info(&_ovf, -1);
-		if ((vi->channels != 1 && vi->channels != 2) || vi->rate != mixerSampleRate) {
+		if (vi->channels != 1 && vi->channels != 2) {
 			warning("Unhandled ogg/pcm format ch %d rate %d", vi->channels, vi->rate);
 			return false;
 		}
 		_channels = vi->channels;
+		_ring = (int16_t *)malloc(kRingFrames * _channels * sizeof(int16_t));
+		if (!_ring) {
+			warning("Unable to allocate ogg ring buffer");
+			return false;
+		}
+		// the samples are copied as is when the track rate matches the mixer
+		_resampler.init(_channels, vi->rate, mixerSampleRate);
+		// have some frames ready for the first callback
+		fillRing();
+		_thread = std::thread(&OggDecoder_impl::decodeThread, this);
 		return true;
 	}
-	int read(int16_t *dst, int samples) {
-		int size = samples * _channels * sizeof(int16_t);
-		if (size > _readBufSize) {
-			_readBufSize = size;
-			free(_readBuf);
-			_readBuf = (int16_t *)malloc(_readBufSize);
-			if (!_readBuf) {
-				return 0;
-			}
-		}
+
+	// decoder thread
+	int decode(int16_t *dst, int frames) {
+		const int size = frames * _channels * sizeof(int16_t);
 		int count = 0;
-		while (size > 0) {
-			const int len = ov_read(&_ovf, (char *)_readBuf, size, 0);
+		while (count < size) {
+			const int len = ov_read(&_ovf, (char *)dst + count, size - count, 0);
 			if (len < 0) {
 				// error in decoder
-				return count;
+				_error = true;
+				break;
 			} else if (len == 0) {
 				// loop
 				ov_raw_seek(&_ovf, 0);
 				continue;
 			}
-			assert((len & 1) == 0);
-			switch (_channels) {
-			case 2:
-				assert((len & 3) == 0);
-				for (int i = 0; i < len / 2; i += 2) {
-					const int16_t s16 = (_readBuf[i] + _readBuf[i + 1]) / 2;
-					*dst = ADDC_S16(*dst, s16);
-					++dst;
-				}
-				break;
-			case 1:
-				for (int i = 0; i < len / 2; ++i) {
-					*dst = ADDC_S16(*dst, _readBuf[i]);
-					++dst;
+			count += len;
+		}
+		return count / (_channels * sizeof(int16_t));
+	}
+	bool fillRing() {
+		const uint32_t head = _ringHead.load(std::memory_order_relaxed);
+		const uint32_t space = kRingFrames - (head - _ringTail.load(std::memory_order_acquire));
+		const uint32_t offset = head & (kRingFrames - 1);
+		const int frames = MIN<uint32_t>(MIN<uint32_t>(space, kRingFrames - offset), kDecodeFrames);
+		if (frames == 0 || _error) {
+			return false;
+		}
+		const int count = decode(_ring + offset * _channels, frames);
+		_ringHead.store(head + count, std::memory_order_release);
+		return count != 0;
+	}
+	void decodeThread() {
+		while (!_stop) {
+			if (!fillRing()) {
+				if (_error) {
+					break;
 				}
-				break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(kDecodeSleepMs));
 			}
-			size -= len;
-			count += len;
 		}
-		assert(size == 0);
+	}
+
+	// audio thread
+	int readFrames(int16_t *dst, int frames) {
+		const uint32_t tail = _ringTail.load(std::memory_order_relaxed);
+		const uint32_t available = _ringHead.load(std::memory_order_acquire) - tail;
+		const int count = MIN<uint32_t>(frames, available);
+		const uint32_t offset = tail & (kRingFrames - 1);
+		const int count1 = MIN<uint32_t>(count, kRingFrames - offset);
+		memcpy(dst, _ring + offset * _channels, count1 * _channels * sizeof(int16_t));
+		memcpy(dst + count1 * _channels, _ring, (count - count1) * _channels * sizeof(int16_t));
+		_ringTail.store(tail + count, std::memory_order_release);
 		return count;
 	}
+	bool mix(int16_t *dst, int len) {
+		_resampler.mix(dst, len, readFramesCallback, this);
+		// stop once the frames decoded before the error are played
+		return !_error || _ringHead.load(std::memory_order_acquire) != _ringTail.load(std::memory_order_relaxed);
+	}
+	static int readFramesCallback(void *param, int16_t *buf, int frames) {
+		return ((OggDecoder_impl *)param)->readFrames(buf, frames);
+	}
 
 	OggVorbis_File _ovf;
 	int _channels;
 	bool _open;
-	int16_t *_readBuf;
-	int _readBufSize;
+	int16_t *_ring;
+	std::atomic<uint32_t> _ringHead, _ringTail;
+	std::atomic<bool> _stop, _error;
+	std::thread _thread;
+	Resampler _resampler;
 };
 #endif
 
@@ -196,7 +242,7 @@ void OggPlayer::resumeTrack() {
 bool OggPlayer::mix(int16_t *buf, int len) {
 #ifdef USE_TREMOR
 	if (_impl) {
-		return _impl->read(buf, len) != 0;
+		return _impl->mix(buf, len);
 	}
 #endif
 	return false;
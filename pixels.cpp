@@ -0,0 +1,222 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PIXELS_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define PIXELS_NEON
+#include <arm_neon.h>
+#endif
+#include "pixels.h"
+#include "util.h"
+
+typedef void (*ExpandPaletteProc)(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette);
+typedef void (*ExpandRgb24Proc)(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt);
+
+static void expandPalette_C(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette) {
+	for (int y = 0; y < h; ++y) {
+		int x = 0;
+		for (; x + 4 <= w; x += 4) {
+			dst[x]     = palette[src[x]];
+			dst[x + 1] = palette[src[x + 1]];
+			dst[x + 2] = palette[src[x + 2]];
+			dst[x + 3] = palette[src[x + 3]];
+		}
+		for (; x < w; ++x) {
+			dst[x] = palette[src[x]];
+		}
+		dst += dstPitch;
+		src += srcPitch;
+	}
+}
+
+static void expandRgb24_C(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt) {
+	const int rShift = fmt->rShift;
+	const int gShift = fmt->gShift;
+	const int bShift = fmt->bShift;
+	const uint32_t aMask = fmt->aMask;
+	for (int y = 0; y < h; ++y) {
+		for (int x = 0; x < w; ++x) {
+			dst[x] = ((uint32_t)rgb[0] << rShift) | ((uint32_t)rgb[1] << gShift) | ((uint32_t)rgb[2] << bShift) | aMask; rgb += 3;
+		}
+		dst += dstPitch;
+	}
+}
+
+static bool isByteAligned(const Rgb24Format *fmt) {
+	return (fmt->rShift & 7) == 0 && (fmt->gShift & 7) == 0 && (fmt->bShift & 7) == 0;
+}
+
+#ifdef PIXELS_X86
+__attribute__((target("avx2")))
+static void expandPalette_AVX2(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette) {
+	const int *lut = (const int *)palette;
+	for (int y = 0; y < h; ++y) {
+		int x = 0;
+		for (; x + 16 <= w; x += 16) {
+			const __m128i idx = _mm_loadu_si128((const __m128i *)(src + x));
+			const __m256i lo = _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(idx), 4);
+			const __m256i hi = _mm256_i32gather_epi32(lut, _mm256_cvtepu8_epi32(_mm_srli_si128(idx, 8)), 4);
+			_mm256_storeu_si256((__m256i *)(dst + x), lo);
+			_mm256_storeu_si256((__m256i *)(dst + x + 8), hi);
+		}
+		for (; x < w; ++x) {
+			dst[x] = palette[src[x]];
+		}
+		dst += dstPitch;
+		src += srcPitch;
+	}
+}
+
+__attribute__((target("ssse3")))
+static void expandRgb24_SSSE3(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt) {
+	if (!isByteAligned(fmt)) {
+		expandRgb24_C(dst, dstPitch, rgb, w, h, fmt);
+		return;
+	}
+	// move the 4 triplets of a 16 bytes load to their component offsets
+	uint8_t shuffle[16];
+	for (int i = 0; i < 4; ++i) {
+		for (int j = 0; j < 4; ++j) {
+			uint8_t index = 0x80;
+			if (j == fmt->rShift / 8) {
+				index = i * 3;
+			} else if (j == fmt->gShift / 8) {
+				index = i * 3 + 1;
+			} else if (j == fmt->bShift / 8) {
+				index = i * 3 + 2;
+			}
+			shuffle[i * 4 + j] = index;
+		}
+	}
+	const __m128i mask = _mm_loadu_si128((const __m128i *)shuffle);
+	const __m128i alpha = _mm_set1_epi32(fmt->aMask);
+	for (int y = 0; y < h; ++y) {
+		int x = 0;
+		// the last 4 bytes of each load are not used, stay within the row
+		for (; x + 6 <= w; x += 4) {
+			const __m128i in = _mm_loadu_si128((const __m128i *)rgb);
+			_mm_storeu_si128((__m128i *)(dst + x), _mm_or_si128(_mm_shuffle_epi8(in, mask), alpha));
+			rgb += 12;
+		}
+		for (; x < w; ++x) {
+			dst[x] = ((uint32_t)rgb[0] << fmt->rShift) | ((uint32_t)rgb[1] << fmt->gShift) | ((uint32_t)rgb[2] << fmt->bShift) | fmt->aMask; rgb += 3;
+		}
+		dst += dstPitch;
+	}
+}
+#endif
+
+#ifdef PIXELS_NEON
+static void expandPalette_NEON(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette) {
+	// one 256 bytes table per color component, split in 64 bytes blocks for tbl
+	uint8_t planes[4][256];
+	for (int i = 0; i < 256; i += 16) {
+		const uint8x16x4_t c = vld4q_u8((const uint8_t *)(palette + i));
+		for (int j = 0; j < 4; ++j) {
+			vst1q_u8(&planes[j][i], c.val[j]);
+		}
+	}
+	uint8x16x4_t lut[4][4];
+	for (int j = 0; j < 4; ++j) {
+		for (int k = 0; k < 4; ++k) {
+			for (int n = 0; n < 4; ++n) {
+				lut[j][k].val[n] = vld1q_u8(&planes[j][k * 64 + n * 16]);
+			}
+		}
+	}
+	const uint8x16_t offset = vdupq_n_u8(64);
+	for (int y = 0; y < h; ++y) {
+		int x = 0;
+		for (; x + 16 <= w; x += 16) {
+			const uint8x16_t idx0 = vld1q_u8(src + x);
+			const uint8x16_t idx1 = vsubq_u8(idx0, offset);
+			const uint8x16_t idx2 = vsubq_u8(idx1, offset);
+			const uint8x16_t idx3 = vsubq_u8(idx2, offset);
+			uint8x16x4_t out;
+			for (int j = 0; j < 4; ++j) {
+				// out of range indexes leave the previous lookup untouched
+				uint8x16_t c = vqtbl4q_u8(lut[j][0], idx0);
+				c = vqtbx4q_u8(c, lut[j][1], idx1);
+				c = vqtbx4q_u8(c, lut[j][2], idx2);
+				c = vqtbx4q_u8(c, lut[j][3], idx3);
+				out.val[j] = c;
+			}
+			vst4q_u8((uint8_t *)(dst + x), out);
+		}
+		for (; x < w; ++x) {
+			dst[x] = palette[src[x]];
+		}
+		dst += dstPitch;
+		src += srcPitch;
+	}
+}
+
+static void expandRgb24_NEON(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt) {
+	if (!isByteAligned(fmt)) {
+		expandRgb24_C(dst, dstPitch, rgb, w, h, fmt);
+		return;
+	}
+	const int r = fmt->rShift / 8;
+	const int g = fmt->gShift / 8;
+	const int b = fmt->bShift / 8;
+	for (int y = 0; y < h; ++y) {
+		int x = 0;
+		for (; x + 16 <= w; x += 16) {
+			const uint8x16x3_t in = vld3q_u8(rgb);
+			uint8x16x4_t out;
+			for (int j = 0; j < 4; ++j) {
+				out.val[j] = vdupq_n_u8((fmt->aMask >> (j * 8)) & 255);
+			}
+			out.val[r] = in.val[0];
+			out.val[g] = in.val[1];
+			out.val[b] = in.val[2];
+			vst4q_u8((uint8_t *)(dst + x), out);
+			rgb += 48;
+		}
+		for (; x < w; ++x) {
+			dst[x] = ((uint32_t)rgb[0] << fmt->rShift) | ((uint32_t)rgb[1] << fmt->gShift) | ((uint32_t)rgb[2] << fmt->bShift) | fmt->aMask; rgb += 3;
+		}
+		dst += dstPitch;
+	}
+}
+#endif
+
+static ExpandPaletteProc selectExpandPalette() {
+#if defined(PIXELS_X86)
+	if (__builtin_cpu_supports("avx2")) {
+		debug(DBG_INFO, "Using AVX2 palette expansion");
+		return expandPalette_AVX2;
+	}
+#elif defined(PIXELS_NEON)
+	debug(DBG_INFO, "Using NEON palette expansion");
+	return expandPalette_NEON;
+#endif
+	return expandPalette_C;
+}
+
+static ExpandRgb24Proc selectExpandRgb24() {
+#if defined(PIXELS_X86)
+	if (__builtin_cpu_supports("ssse3")) {
+		return expandRgb24_SSSE3;
+	}
+#elif defined(PIXELS_NEON)
+	return expandRgb24_NEON;
+#endif
+	return expandRgb24_C;
+}
+
+void expandPalette(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette) {
+	static const ExpandPaletteProc proc = selectExpandPalette();
+	proc(dst, dstPitch, src, srcPitch, w, h, palette);
+}
+
+void expandRgb24(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt) {
+	static const ExpandRgb24Proc proc = selectExpandRgb24();
+	proc(dst, dstPitch, rgb, w, h, fmt);
+}
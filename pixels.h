@@ -0,0 +1,22 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PIXELS_H__
+#define PIXELS_H__
+
+#include <stdint.h>
+
+struct Rgb24Format {
+	uint8_t rShift, gShift, bShift;
+	uint32_t aMask;
+};
+
+// 8-bit indexed to 32-bit, 'palette' holds 256 entries
+void expandPalette(uint32_t *dst, int dstPitch, const uint8_t *src, int srcPitch, int w, int h, const uint32_t *palette);
+// packed RGB triplets to 32-bit, 'rgb' is contiguous
+void expandRgb24(uint32_t *dst, int dstPitch, const uint8_t *rgb, int w, int h, const Rgb24Format *fmt);
+
+#endif // PIXELS_H__
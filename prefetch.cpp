@@ -0,0 +1,104 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "file.h"
+#include "prefetch.h"
+#include "util.h"
+
+FilePrefetch::FilePrefetch(FileSystem *fs)
+	: _fs(fs), _entriesCount(0), _requestsCount(0) {
+}
+
+FilePrefetch::~FilePrefetch() {
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+	for (int i = 0; i < _entriesCount; ++i) {
+		free(_entries[i].data);
+	}
+}
+
+void FilePrefetch::add(const char *name) {
+	if (_requestsCount < kMaxEntries) {
+		snprintf(_requests[_requestsCount], sizeof(_requests[0]), "%s", name);
+		++_requestsCount;
+	}
+}
+
+void FilePrefetch::start() {
+	if (_thread.joinable()) {
+		_thread.join();
+	}
+	// keep the files already in memory, drop the ones no longer requested
+	FilePrefetchEntry entries[kMaxEntries];
+	for (int i = 0; i < _requestsCount; ++i) {
+		FilePrefetchEntry *e = &entries[i];
+		snprintf(e->name, sizeof(e->name), "%s", _requests[i]);
+		e->data = 0;
+		e->size = 0;
+		e->ready = false;
+		for (int j = 0; j < _entriesCount; ++j) {
+			if (_entries[j].data && strcasecmp(_entries[j].name, e->name) == 0) {
+				e->data = _entries[j].data;
+				e->size = _entries[j].size;
+				e->ready = true;
+				_entries[j].data = 0;
+				break;
+			}
+		}
+	}
+	for (int i = 0; i < _entriesCount; ++i) {
+		free(_entries[i].data);
+	}
+	memcpy(_entries, entries, _requestsCount * sizeof(FilePrefetchEntry));
+	_entriesCount = _requestsCount;
+	_requestsCount = 0;
+	_thread = std::thread(&FilePrefetch::readEntries, this);
+}
+
+uint8_t *FilePrefetch::take(const char *name, uint32_t *size) {
+	std::unique_lock<std::mutex> lock(_mutex);
+	for (int i = 0; i < _entriesCount; ++i) {
+		FilePrefetchEntry *e = &_entries[i];
+		if (strcasecmp(e->name, name) == 0) {
+			// only wait for that file to be read
+			_cond.wait(lock, [e] { return e->ready; });
+			uint8_t *data = e->data;
+			*size = e->size;
+			e->data = 0;
+			return data;
+		}
+	}
+	return 0;
+}
+
+void FilePrefetch::readEntries() {
+	for (int i = 0; i < _entriesCount; ++i) {
+		FilePrefetchEntry *e = &_entries[i];
+		if (e->ready) {
+			continue;
+		}
+		uint8_t *data = 0;
+		uint32_t size = 0;
+		File f;
+		if (f.open(e->name, "rb", _fs)) {
+			size = f.size();
+			data = (uint8_t *)malloc(size);
+			if (data && f.read(data, size) == size && !f.ioErr()) {
+				debug(DBG_FILE, "Prefetched '%s' size %d", e->name, size);
+			} else {
+				free(data);
+				data = 0;
+				size = 0;
+			}
+		}
+		std::lock_guard<std::mutex> lock(_mutex);
+		e->data = data;
+		e->size = size;
+		e->ready = true;
+		_cond.notify_all();
+	}
+}
@@ -0,0 +1,47 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PREFETCH_H__
+#define PREFETCH_H__
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "intern.h"
+
+struct FileSystem;
+
+struct FilePrefetchEntry {
+	char name[32];
+	uint8_t *data;
+	uint32_t size;
+	bool ready;
+};
+
+// reads files in a background thread, the main thread then takes the buffers
+struct FilePrefetch {
+
+	static const int kMaxEntries = 20;
+
+	FileSystem *_fs;
+	FilePrefetchEntry _entries[kMaxEntries];
+	int _entriesCount;
+	char _requests[kMaxEntries][32];
+	int _requestsCount;
+	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _cond;
+
+	FilePrefetch(FileSystem *fs);
+	~FilePrefetch();
+
+	void add(const char *name);
+	void start();
+	uint8_t *take(const char *name, uint32_t *size);
+	void readEntries();
+};
+
+#endif // PREFETCH_H__
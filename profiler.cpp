@@ -0,0 +1,100 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "profiler.h"
+#include "util.h"
+
+Profiler g_profiler;
+
+const char *Profiler::_phaseNames[] = {
+	"frame",
+	"input",
+	"prepare",
+	"collision",
+	"process",
+	"loadmap",
+	"anims",
+	"updatescreen",
+	"scaler",
+	"present",
+	"autosave"
+};
+
+void Profiler::enable(const char *csvPath) {
+	if (!_enabled) {
+		memset(_startTime, 0, sizeof(_startTime));
+		memset(_samplesCount, 0, sizeof(_samplesCount));
+		memset(_samplesPos, 0, sizeof(_samplesPos));
+		memset(_stats, 0, sizeof(_stats));
+		_framesCount = 0;
+		_enabled = true;
+	}
+	if (csvPath && !_csv) {
+		_csv = fopen(csvPath, "w");
+		if (!_csv) {
+			warning("Unable to open '%s' for writing", csvPath);
+		} else {
+			fprintf(_csv, "frame,phase,count,min_us,avg_us,p99_us\n");
+		}
+	}
+}
+
+void Profiler::disable() {
+	if (_csv) {
+		fclose(_csv);
+		_csv = 0;
+	}
+	_enabled = false;
+}
+
+void Profiler::endFrame() {
+	if (_enabled) {
+		++_framesCount;
+		if ((_framesCount % kStatsInterval) == 0) {
+			updateStats();
+		}
+	}
+}
+
+void Profiler::addSample(int phase, uint64_t ns) {
+	const uint64_t us = ns / 1000;
+	_samples[phase][_samplesPos[phase]] = (us > 0xFFFFFFFF) ? 0xFFFFFFFF : us;
+	_samplesPos[phase] = (_samplesPos[phase] + 1) % kWindowSize;
+	if (_samplesCount[phase] < kWindowSize) {
+		++_samplesCount[phase];
+	}
+}
+
+void Profiler::updateStats() {
+	for (int i = 0; i < kProfilePhasesCount; ++i) {
+		ProfileStats *stats = &_stats[i];
+		const int count = _samplesCount[i];
+		stats->count = count;
+		if (count == 0) {
+			stats->min = stats->avg = stats->p99 = 0;
+			continue;
+		}
+		uint32_t sorted[kWindowSize];
+		memcpy(sorted, _samples[i], count * sizeof(uint32_t));
+		std::sort(sorted, sorted + count);
+		uint64_t sum = 0;
+		for (int j = 0; j < count; ++j) {
+			sum += sorted[j];
+		}
+		stats->min = sorted[0];
+		stats->avg = sum / count;
+		stats->p99 = sorted[(count * 99 - 1) / 100];
+		if (_csv) {
+			fprintf(_csv, "%d,%s,%d,%d,%d,%d\n", _framesCount, _phaseNames[i], count, stats->min, stats->avg, stats->p99);
+		}
+	}
+}
+
+uint64_t Profiler::getTime() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,83 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef PROFILER_H__
+#define PROFILER_H__
+
+#include "intern.h"
+
+enum {
+	kProfileFrame,
+	kProfileInput,
+	kProfilePrepare,
+	kProfileCollision,
+	kProfileProcess,
+	kProfileLoadMap,
+	kProfileAnims,
+	kProfileUpdateScreen,
+	kProfileScaler,
+	kProfilePresent,
+	kProfileAutoSave,
+	kProfilePhasesCount
+};
+
+struct ProfileStats {
+	uint32_t min, avg, p99; // microseconds
+	int count;
+};
+
+struct Profiler {
+	enum {
+		kWindowSize = 128,
+		kStatsInterval = 32 // frames
+	};
+
+	static const char *_phaseNames[];
+
+	bool _enabled;
+	FILE *_csv;
+	uint32_t _framesCount;
+	uint64_t _startTime[kProfilePhasesCount];
+	uint32_t _samples[kProfilePhasesCount][kWindowSize];
+	int _samplesCount[kProfilePhasesCount];
+	int _samplesPos[kProfilePhasesCount];
+	ProfileStats _stats[kProfilePhasesCount];
+
+	void enable(const char *csvPath = 0);
+	void disable();
+
+	void begin(int phase) {
+		if (_enabled) {
+			_startTime[phase] = getTime();
+		}
+	}
+	void end(int phase) {
+		if (_enabled && _startTime[phase] != 0) {
+			addSample(phase, getTime() - _startTime[phase]);
+			_startTime[phase] = 0;
+		}
+	}
+	void endFrame();
+
+	void addSample(int phase, uint64_t ns);
+	void updateStats();
+	static uint64_t getTime();
+};
+
+extern Profiler g_profiler;
+
+struct ProfileScope {
+	ProfileScope(int phase)
+		: _phase(phase) {
+		g_profiler.begin(phase);
+	}
+	~ProfileScope() {
+		g_profiler.end(_phase);
+	}
+	int _phase;
+};
+
+#endif // PROFILER_H__
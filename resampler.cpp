@@ -0,0 +1,134 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include <math.h>
+#include "resampler.h"
+
+static const int kFilterBits = 14;
+
+static double sinc(double x) {
+	if (x == 0.) {
+		return 1.;
+	}
+	const double a = M_PI * x;
+	return sin(a) / a;
+}
+
+void Resampler::init(int channels, int inputRate, int outputRate) {
+	assert(channels == 1 || channels == 2);
+	_channels = channels;
+	_inputRate = inputRate;
+	_outputRate = outputRate;
+	const uint64_t step = ((uint64_t)inputRate << 32) / outputRate;
+	_stepInt = step >> 32;
+	_stepFrac = step & 0xFFFFFFFF;
+	// the first output frame is centered on the first input frame
+	_pos = 0;
+	_frac = 0;
+	_count = kTaps / 2 - 1;
+	memset(_frames, 0, sizeof(_frames));
+	// low-pass below the lowest of the two Nyquist frequencies
+	const double cutoff = 0.45 * MIN(1., outputRate / (double)inputRate);
+	const int phases = 1 << kPhaseBits;
+	for (int p = 0; p < phases; ++p) {
+		double coeffs[kTaps];
+		double sum = 0.;
+		for (int k = 0; k < kTaps; ++k) {
+			const double x = k - (kTaps / 2 - 1) - p / (double)phases;
+			// Blackman window over the filter span
+			const double w = (x + kTaps / 2) / kTaps;
+			const double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+			coeffs[k] = 2 * cutoff * sinc(2 * cutoff * x) * window;
+			sum += coeffs[k];
+		}
+		// unity gain for each phase
+		for (int k = 0; k < kTaps; ++k) {
+			_filter[p][k] = (int16_t)lrint(coeffs[k] / sum * (1 << kFilterBits));
+		}
+	}
+}
+
+int Resampler::read(int16_t *dst, int frames, ReadProc proc, void *userData) {
+	const int count = proc(userData, _readBuf, MIN<int>(frames, kBufferFrames));
+	if (count > 0) {
+		if (_channels == 2) {
+			memcpy(dst, _readBuf, count * 2 * sizeof(int16_t));
+		} else {
+			for (int i = 0; i < count; ++i) {
+				dst[i * 2] = dst[i * 2 + 1] = _readBuf[i];
+			}
+		}
+	}
+	return count;
+}
+
+void Resampler::fill(ReadProc proc, void *userData) {
+	// when downsampling, the position can be past the buffered frames
+	uint32_t skip = 0;
+	if (_pos > (uint32_t)_count) {
+		skip = _pos - _count;
+		_pos = _count;
+	}
+	// keep the frames still covered by the filter
+	_count -= _pos;
+	memmove(_frames, _frames + _pos * 2, _count * 2 * sizeof(int16_t));
+	_pos = 0;
+	while (skip > 0) {
+		const int count = read(_frames, skip, proc, userData);
+		if (count <= 0) {
+			break;
+		}
+		skip -= count;
+	}
+	while (_count < kBufferFrames) {
+		const int count = read(_frames + _count * 2, kBufferFrames - _count, proc, userData);
+		if (count <= 0) {
+			if (_count < kTaps) {
+				// no input available, pad with silence
+				memset(_frames + _count * 2, 0, (kTaps - _count) * 2 * sizeof(int16_t));
+				_count = kTaps;
+			}
+			break;
+		}
+		_count += count;
+	}
+}
+
+void Resampler::mix(int16_t *dst, int len, ReadProc proc, void *userData) {
+	if (_inputRate == _outputRate) {
+		while (len > 0) {
+			const int count = read(_frames, len, proc, userData);
+			if (count <= 0) {
+				break;
+			}
+			for (int i = 0; i < count * 2; ++i) {
+				dst[i] = ADDC_S16(dst[i], _frames[i]);
+			}
+			dst += count * 2;
+			len -= count;
+		}
+		return;
+	}
+	for (int i = 0; i < len; ++i) {
+		if (_pos + kTaps > (uint32_t)_count) {
+			fill(proc, userData);
+		}
+		const int16_t *coeffs = _filter[_frac >> (32 - kPhaseBits)];
+		const int16_t *src = _frames + _pos * 2;
+		int l = 0;
+		int r = 0;
+		for (int k = 0; k < kTaps; ++k) {
+			l += src[k * 2] * coeffs[k];
+			r += src[k * 2 + 1] * coeffs[k];
+		}
+		dst[0] = ADDC_S16(dst[0], l >> kFilterBits);
+		dst[1] = ADDC_S16(dst[1], r >> kFilterBits);
+		dst += 2;
+		const uint64_t frac = (uint64_t)_frac + _stepFrac;
+		_frac = (uint32_t)frac;
+		_pos += _stepInt + (uint32_t)(frac >> 32);
+	}
+}
@@ -0,0 +1,38 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef RESAMPLER_H__
+#define RESAMPLER_H__
+
+#include "intern.h"
+
+// windowed-sinc polyphase resampler, mono or stereo input to stereo output
+struct Resampler {
+	typedef int (*ReadProc)(void *userData, int16_t *buf, int frames); // returns the number of frames read
+
+	enum {
+		kTaps = 16,
+		kPhaseBits = 8,
+		kBufferFrames = 1024
+	};
+
+	int _channels;
+	uint32_t _inputRate, _outputRate;
+	uint32_t _stepInt, _stepFrac;
+	uint32_t _pos, _frac;
+	int _count;
+	int16_t _filter[1 << kPhaseBits][kTaps];
+	int16_t _frames[kBufferFrames * 2];
+	int16_t _readBuf[kBufferFrames * 2];
+
+	void init(int channels, int inputRate, int outputRate);
+	void mix(int16_t *dst, int len, ReadProc proc, void *userData); // adds 'len' stereo frames to 'dst'
+
+	void fill(ReadProc proc, void *userData);
+	int read(int16_t *dst, int frames, ReadProc proc, void *userData);
+};
+
+#endif // RESAMPLER_H__
@@ -7,6 +7,7 @@
 #include "decode_mac.h"
 #include "file.h"
 #include "fs.h"
+#include "prefetch.h"
 #include "resource.h"
 #include "unpack.h"
 #include "util.h"
@@ -19,6 +20,7 @@ Resource::Resource(FileSystem *fs, ResourceType ver, Language lang) {
 	_isDemo = false;
 	_aba = 0;
 	_mac = 0;
+	_prefetch = new FilePrefetch(fs);
 	_readUint16 = (_type == kResourceTypeDOS) ? READ_LE_UINT16 : READ_BE_UINT16;
 	_readUint32 = (_type == kResourceTypeDOS) ? READ_LE_UINT32 : READ_BE_UINT32;
 	_scratchBuffer = (uint8_t *)malloc(kScratchBufferSize);
@@ -35,13 +37,14 @@ Resource::Resource(FileSystem *fs, ResourceType ver, Language lang) {
 }
 
 Resource::~Resource() {
+	delete _prefetch;
 	clearLevelRes();
 	MAC_unloadLevelData();
 	free(_fnt);
 	free(_icn);
 	free(_tab);
 	free(_spc);
-	free(_spr1);
+	freeData(_spr1, &_spr1Mapping);
 	free(_scratchBuffer);
 	free(_cmd);
 	free(_pol);
@@ -107,9 +110,9 @@ bool Resource::fileExists(const char *filename) {
 
 void Resource::clearLevelRes() {
 	free(_tbn); _tbn = 0;
-	free(_mbk); _mbk = 0;
+	freeData(_mbk, &_mbkMapping); _mbk = 0;
 	free(_pal); _pal = 0;
-	free(_map); _map = 0;
+	freeData(_map, &_mapMapping); _map = 0;
 	free(_lev); _lev = 0;
 	_levNum = -1;
 	free(_sgd); _sgd = 0;
@@ -677,7 +680,12 @@ void Resource::load(const char *objName, int objType, const char *ext) {
 		snprintf(_entryName, sizeof(_entryName), "%s.%s", objName, ext);
 	}
 	File f;
-	if (f.open(_entryName, "rb", _fs)) {
+	uint32_t prefetchedSize;
+	uint8_t *prefetched = _prefetch->take(_entryName, &prefetchedSize);
+	if (prefetched) {
+		f.openMemoryBuffer(prefetched, prefetchedSize);
+	}
+	if (prefetched || f.open(_entryName, "rb", _fs)) {
 		assert(loadStub);
 		(this->*loadStub)(&f);
 		if (f.ioErr()) {
@@ -759,6 +767,52 @@ void Resource::load(const char *objName, int objType, const char *ext) {
 	}
 }
 
+void Resource::prefetch(const char *objName, int objType) {
+	static const struct {
+		int type;
+		const char *ext;
+	} kExtensions[] = {
+		{ OT_MBK, "MBK" },
+		{ OT_PGE, "PGE" },
+		{ OT_PAL, "PAL" },
+		{ OT_CT, "CT" },
+		{ OT_MAP, "MAP" },
+		{ OT_SPC, "SPC" },
+		{ OT_RP, "RP" },
+		{ OT_RPC, "RPC" },
+		{ OT_OBJ, "OBJ" },
+		{ OT_ANI, "ANI" },
+		{ OT_OBC, "OBC" },
+		{ OT_SPL, "SPL" },
+		{ OT_LEV, "LEV" },
+		{ OT_SGD, "SGD" },
+		{ OT_BNQ, "BNQ" },
+		{ -1, 0 }
+	};
+	// same file names as load()
+	char name[32];
+	if (objType == OT_TBN) {
+		snprintf(name, sizeof(name), "%s.%s", objName, getTextBin(_lang, _type));
+		if (!_fs->exists(name)) {
+			snprintf(name, sizeof(name), "%s.TBN", objName);
+		}
+		_prefetch->add(name);
+		return;
+	}
+	for (int i = 0; kExtensions[i].ext; ++i) {
+		if (kExtensions[i].type == objType) {
+			snprintf(name, sizeof(name), "%s.%s", objName, kExtensions[i].ext);
+			_prefetch->add(name);
+			return;
+		}
+	}
+	error("Unimplemented Resource::prefetch() type %d", objType);
+}
+
+void Resource::startPrefetch() {
+	_prefetch->start();
+}
+
 void Resource::load_CT(File *pf) {
 	debug(DBG_RES, "Resource::load_CT()");
 	int len = pf->size();
@@ -785,8 +839,20 @@ void Resource::load_FNT(File *f) {
 	}
 }
 
+void Resource::freeData(uint8_t *p, FileMapping *mapping) {
+	if (mapping->data) {
+		mapping->release();
+	} else {
+		free(p);
+	}
+}
+
 void Resource::load_MBK(File *f) {
 	debug(DBG_RES, "Resource::load_MBK()");
+	if (f->map(&_mbkMapping)) {
+		_mbk = _mbkMapping.data;
+		return;
+	}
 	int len = f->size();
 	_mbk = (uint8_t *)malloc(len);
 	if (!_mbk) {
@@ -814,6 +880,10 @@ void Resource::load_ICN(File *f) {
 
 void Resource::load_SPR(File *f) {
 	debug(DBG_RES, "Resource::load_SPR()");
+	if (f->map(&_spr1Mapping)) {
+		_spr1 = _spr1Mapping.data + 12;
+		return;
+	}
 	int len = f->size() - 12;
 	_spr1 = (uint8_t *)malloc(len);
 	if (!_spr1) {
@@ -862,6 +932,10 @@ void Resource::load_PAL(File *f) {
 
 void Resource::load_MAP(File *f) {
 	debug(DBG_RES, "Resource::load_MAP()");
+	if (f->map(&_mapMapping)) {
+		_map = _mapMapping.data;
+		return;
+	}
 	int len = f->size();
 	_map = (uint8_t *)malloc(len);
 	if (!_map) {
@@ -1334,22 +1408,27 @@ void Resource::load_SPM(File *f) {
 	f->seek(len - 4);
 	const uint32_t size = f->readUint32BE();
 	f->seek(0);
-	uint8_t *tmp = (uint8_t *)malloc(len);
-	if (!tmp) {
-		error("Unable to allocate SPM temporary buffer");
+	const uint8_t *src = f->mappedData();
+	uint8_t *tmp = 0;
+	if (!src) {
+		tmp = (uint8_t *)malloc(len);
+		if (!tmp) {
+			error("Unable to allocate SPM temporary buffer");
+		}
+		f->read(tmp, len);
+		src = tmp;
 	}
-	f->read(tmp, len);
 	if (size == kPersoDatSize) {
 		_spr1 = (uint8_t *)malloc(size);
 		if (!_spr1) {
 			error("Unable to allocate SPR1 buffer");
 		}
-		if (!bytekiller_unpack(_spr1, size, tmp, len)) {
+		if (!bytekiller_unpack(_spr1, size, src, len)) {
 			error("Bad CRC for SPM data");
 		}
 	} else {
 		assert(size <= sizeof(_sprm));
-		if (!bytekiller_unpack(_sprm, sizeof(_sprm), tmp, len)) {
+		if (!bytekiller_unpack(_sprm, sizeof(_sprm), src, len)) {
 			error("Bad CRC for SPM data");
 		}
 	}
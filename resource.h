@@ -13,6 +13,7 @@
 
 struct DecodeBuffer;
 struct File;
+struct FilePrefetch;
 struct FileSystem;
 
 struct LocaleData {
@@ -131,12 +132,14 @@ struct Resource {
 	bool _isDemo;
 	ResourceAba *_aba;
 	ResourceMac *_mac;
+	FilePrefetch *_prefetch;
 	uint16_t (*_readUint16)(const void *);
 	uint32_t (*_readUint32)(const void *);
 	bool _hasSeqData;
 	char _entryName[32];
 	uint8_t *_fnt;
 	uint8_t *_mbk;
+	FileMapping _mbkMapping;
 	uint8_t *_icn;
 	int _icnLen;
 	uint8_t *_tab;
@@ -148,11 +151,13 @@ struct Resource {
 	uint8_t *_tbn;
 	int8_t _ctData[0x1D00];
 	uint8_t *_spr1;
+	FileMapping _spr1Mapping;
 	uint8_t *_sprData[NUM_SPRITES]; // 0-0x22F + 0x28E-0x2E9 ... conrad, 0x22F-0x28D : junkie
 	uint8_t _sprm[0x10000];
 	uint16_t _pgeNum;
 	InitPGE _pgeInit[256];
 	uint8_t *_map;
+	FileMapping _mapMapping;
 	uint8_t *_lev;
 	int _levNum;
 	uint8_t *_sgd;
@@ -199,6 +204,7 @@ struct Resource {
 	bool fileExists(const char *filename);
 
 	void clearLevelRes();
+	void freeData(uint8_t *p, FileMapping *mapping);
 	void load_DEM(const char *filename);
 	void load_FIB(const char *fileName);
 	void load_SPL_demo();
@@ -212,6 +218,8 @@ struct Resource {
 	void free_TEXT();
 	void unload(int objType);
 	void load(const char *objName, int objType, const char *ext = 0);
+	void prefetch(const char *objName, int objType);
+	void startPrefetch();
 	void load_CT(File *pf);
 	void load_FNT(File *pf);
 	void load_MBK(File *pf);
@@ -60,6 +60,21 @@ uint8_t *ResourceAba::loadEntry(const char *name, uint32_t *size) {
 		if (size) {
 			*size = e->size;
 		}
+		const uint8_t *data = _f.mappedData();
+		if (data && e->compressedSize != e->size) {
+			// unpack from the mapped file
+			dst = (uint8_t *)malloc(e->size);
+			if (!dst) {
+				error("Failed to allocate %d bytes", e->size);
+				return 0;
+			}
+			assert(e->offset + e->compressedSize <= _f.size());
+			const bool ret = bytekiller_unpack(dst, e->size, data + e->offset, e->compressedSize);
+			if (!ret) {
+				error("Bad CRC for '%s'", name);
+			}
+			return dst;
+		}
 		uint8_t *tmp = (uint8_t *)malloc(e->compressedSize);
 		if (!tmp) {
 			error("Failed to allocate %d bytes", e->compressedSize);
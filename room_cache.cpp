@@ -0,0 +1,87 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "room_cache.h"
+#include "util.h"
+
+RoomCache::RoomCache()
+	: _entriesCount(0), _size(0), _maxSize(kDefaultMaxSize), _counter(0) {
+}
+
+RoomCache::~RoomCache() {
+	clear();
+}
+
+void RoomCache::setMaxSize(uint32_t size) {
+	_maxSize = size;
+	while (_entriesCount != 0 && _size > _maxSize) {
+		const int lru = findLeastRecentlyUsed();
+		removeEntry(lru);
+	}
+}
+
+void RoomCache::clear() {
+	for (int i = 0; i < _entriesCount; ++i) {
+		free(_entries[i].layer);
+	}
+	_entriesCount = 0;
+	_size = 0;
+}
+
+RoomCacheEntry *RoomCache::find(int level, int room, int levNum) {
+	for (int i = 0; i < _entriesCount; ++i) {
+		RoomCacheEntry *e = &_entries[i];
+		if (e->level == level && e->room == room && e->levNum == levNum) {
+			e->lastUse = ++_counter;
+			return e;
+		}
+	}
+	return 0;
+}
+
+void RoomCache::insert(int level, int room, int levNum, const uint8_t *layer, uint32_t layerSize, const uint8_t *palSlots) {
+	if (layerSize > _maxSize) {
+		return;
+	}
+	while (_entriesCount == kMaxEntries || _size + layerSize > _maxSize) {
+		const int lru = findLeastRecentlyUsed();
+		debug(DBG_VIDEO, "RoomCache::insert() discard level %d room %d", _entries[lru].level, _entries[lru].room);
+		removeEntry(lru);
+	}
+	uint8_t *p = (uint8_t *)malloc(layerSize);
+	if (!p) {
+		return;
+	}
+	memcpy(p, layer, layerSize);
+	RoomCacheEntry *e = &_entries[_entriesCount++];
+	e->level = level;
+	e->room = room;
+	e->levNum = levNum;
+	e->layer = p;
+	e->size = layerSize;
+	memcpy(e->palSlots, palSlots, sizeof(e->palSlots));
+	e->lastUse = ++_counter;
+	_size += layerSize;
+}
+
+int RoomCache::findLeastRecentlyUsed() const {
+	int lru = 0;
+	for (int i = 1; i < _entriesCount; ++i) {
+		if (_entries[i].lastUse < _entries[lru].lastUse) {
+			lru = i;
+		}
+	}
+	return lru;
+}
+
+void RoomCache::removeEntry(int i) {
+	_size -= _entries[i].size;
+	free(_entries[i].layer);
+	--_entriesCount;
+	if (i != _entriesCount) {
+		_entries[i] = _entries[_entriesCount];
+	}
+}
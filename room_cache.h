@@ -0,0 +1,42 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#ifndef ROOM_CACHE_H__
+#define ROOM_CACHE_H__
+
+#include "intern.h"
+
+struct RoomCacheEntry {
+	int level, room, levNum;
+	uint8_t *layer;
+	uint32_t size;
+	uint8_t palSlots[4];
+	uint32_t lastUse;
+};
+
+// decoded room bitmaps, the least recently used ones are discarded first
+struct RoomCache {
+
+	static const int kMaxEntries = 64;
+	static const int kDefaultMaxSize = 1024 * 1024;
+
+	RoomCacheEntry _entries[kMaxEntries];
+	int _entriesCount;
+	uint32_t _size, _maxSize;
+	uint32_t _counter;
+
+	RoomCache();
+	~RoomCache();
+
+	void setMaxSize(uint32_t size);
+	void clear();
+	RoomCacheEntry *find(int level, int room, int levNum);
+	void insert(int level, int room, int levNum, const uint8_t *layer, uint32_t layerSize, const uint8_t *palSlots);
+	int findLeastRecentlyUsed() const;
+	void removeEntry(int i);
+};
+
+#endif // ROOM_CACHE_H__
@@ -4,6 +4,9 @@
  * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "scaler.h"
 #include "util.h"
 #include "xbrz.h"
@@ -246,23 +249,20 @@ static void scale3x(uint32_t *dst, int dstPitch, const uint32_t *src, int srcPit
 static void scale4x(uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h) {
 	static struct {
 		uint32_t *ptr;
-		int w, h, pitch;
 		int size;
 	} buf;
 	const int size = (w * 2) * (h * 2) * sizeof(uint32_t);
 	if (buf.size < size) {
 		free(buf.ptr);
 		buf.size = size;
-		buf.w = w * 2;
-		buf.h = h * 2;
-		buf.pitch = buf.w;
 		buf.ptr = (uint32_t *)malloc(buf.size);
 		if (!buf.ptr) {
 			error("Unable to allocate scale4x intermediate buffer");
 		}
 	}
-	scale2x(buf.ptr, buf.pitch, src, srcPitch, w, h);
-	scale2x(dst, dstPitch, buf.ptr, buf.pitch, buf.w, buf.h);
+	// the buffer may be larger than needed when scaling a part of the screen
+	scale2x(buf.ptr, w * 2, src, srcPitch, w, h);
+	scale2x(dst, dstPitch, buf.ptr, w * 2, w * 2, h * 2);
 }
 
 static void scaleNx(int factor, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h) {
@@ -283,8 +283,112 @@ const Scaler _internalScaler = {
 	scaleNx,
 };
 
+// persistent worker threads scaling bands of rows in parallel
+struct ScalerThreads {
+	enum {
+		kMaxThreads = 8,
+		kMinBandRows = 16
+	};
+
+	std::mutex _mutex;
+	std::condition_variable _startCond;
+	std::condition_variable _doneCond;
+	std::thread _threads[kMaxThreads];
+	int _threadsCount;
+	bool _quit;
+	uint32_t _generation;
+	int _factor;
+	const uint32_t *_src;
+	uint32_t *_dst;
+	int _w, _h;
+	int _bandRows;
+	int _nextRow;
+	int _pendingBands;
+
+	ScalerThreads()
+		: _threadsCount(0), _quit(false), _generation(0) {
+		const int cpus = std::thread::hardware_concurrency();
+		// the calling thread processes bands too
+		for (int i = 0; i < MIN(cpus - 1, (int)kMaxThreads); ++i) {
+			_threads[i] = std::thread(&ScalerThreads::run, this);
+			++_threadsCount;
+		}
+	}
+	~ScalerThreads() {
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_quit = true;
+		}
+		_startCond.notify_all();
+		for (int i = 0; i < _threadsCount; ++i) {
+			_threads[i].join();
+		}
+	}
+
+	bool processBand() {
+		int yFirst;
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			if (_nextRow >= _h) {
+				return false;
+			}
+			yFirst = _nextRow;
+			_nextRow += _bandRows;
+		}
+		// the slices do not overlap, each one reads the rows around it from the whole source
+		xbrz::scale(_factor, _src, _dst, _w, _h, xbrz::ColorFormat::RGB, xbrz::ScalerCfg(), yFirst, MIN(yFirst + _bandRows, _h));
+		std::lock_guard<std::mutex> lock(_mutex);
+		if (--_pendingBands == 0) {
+			_doneCond.notify_one();
+		}
+		return true;
+	}
+
+	void run() {
+		uint32_t generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_startCond.wait(lock, [&]() { return _quit || _generation != generation; });
+				if (_quit) {
+					return;
+				}
+				generation = _generation;
+			}
+			while (processBand()) {
+			}
+		}
+	}
+
+	void scale(int factor, uint32_t *dst, const uint32_t *src, int w, int h) {
+		const int bands = MIN(_threadsCount + 1, h / kMinBandRows);
+		if (bands <= 1) {
+			xbrz::scale(factor, src, dst, w, h, xbrz::ColorFormat::RGB);
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_factor = factor;
+			_src = src;
+			_dst = dst;
+			_w = w;
+			_h = h;
+			_bandRows = (h + bands - 1) / bands;
+			_nextRow = 0;
+			_pendingBands = (h + _bandRows - 1) / _bandRows;
+			++_generation;
+		}
+		_startCond.notify_all();
+		while (processBand()) {
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		_doneCond.wait(lock, [&]() { return _pendingBands == 0; });
+	}
+};
+
 static void Nxbrz(int factor, uint32_t *dst, int dstPitch, const uint32_t *src, int srcPitch, int w, int h) {
-	xbrz::scale(factor, src, dst, w, h, xbrz::ColorFormat::RGB);
+	static ScalerThreads threads;
+	threads.scale(factor, dst, src, w, h);
 }
 
 const Scaler scaler_xbr = {
@@ -4,6 +4,7 @@
  * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
  */
 
+#include <chrono>
 #include "file.h"
 #include "fs.h"
 #include "mixer.h"
@@ -16,11 +17,20 @@ bool SeqDemuxer::open(File *f) {
 	_fileSize = _f->size();
 	memset(_buffers, 0, sizeof(_buffers));
 	_frameOffset = 0;
+	_readBuffer = (uint8_t *)malloc(kReadFramesCount * kFrameSize);
+	if (!_readBuffer) {
+		warning("Unable to allocate SEQ read buffer");
+		return false;
+	}
+	_readBufferOffset = 0;
+	_readBufferSize = 0;
 	return readHeader();
 }
 
 void SeqDemuxer::close() {
 	_f = 0;
+	free(_readBuffer);
+	_readBuffer = 0;
 	for (int i = 0; i < kBuffersCount; ++i) {
 		free(_buffers[i].data);
 	}
@@ -55,18 +65,27 @@ bool SeqDemuxer::readFrameData() {
 	if (_frameOffset >= _fileSize) {
 		return false;
 	}
-	_f->seek(_frameOffset);
-	_audioDataOffset = _f->readUint16LE();
+	if (_frameOffset + kFrameSize > _readBufferOffset + _readBufferSize) {
+		// the frames are stored sequentially, read the next ones
+		const int size = MIN(kReadFramesCount * kFrameSize, _fileSize - _frameOffset);
+		_f->seek(_frameOffset);
+		_f->read(_readBuffer, size);
+		memset(_readBuffer + size, 0, kReadFramesCount * kFrameSize - size);
+		_readBufferOffset = _frameOffset;
+		_readBufferSize = MAX(size, (int)kFrameSize);
+	}
+	_frameData = _readBuffer + _frameOffset - _readBufferOffset;
+	_audioDataOffset = READ_LE_UINT16(_frameData);
 	_audioDataSize = (_audioDataOffset != 0) ? kAudioBufferSize * 2 : 0;
-	_paletteDataOffset = _f->readUint16LE();
+	_paletteDataOffset = READ_LE_UINT16(_frameData + 2);
 	_paletteDataSize = (_paletteDataOffset != 0) ? 768 : 0;
 	uint8_t num[4];
 	for (int i = 0; i < 4; ++i) {
-		num[i] = _f->readByte();
+		num[i] = _frameData[4 + i];
 	}
 	uint16_t offsets[4];
 	for (int i = 0; i < 4; ++i) {
-		offsets[i] = _f->readUint16LE();
+		offsets[i] = READ_LE_UINT16(_frameData + 8 + i * 2);
 	}
 	for (int i = 0; i < 3; ++i) {
 		if (offsets[i] != 0) {
@@ -88,9 +107,9 @@ bool SeqDemuxer::readFrameData() {
 
 void SeqDemuxer::fillBuffer(int num, int offset, int size) {
 	assert(num < kBuffersCount);
-	_f->seek(_frameOffset + offset);
+	assert(offset + size <= kFrameSize);
 	assert(_buffers[num].size + size <= _buffers[num].avail);
-	_f->read(_buffers[num].data + _buffers[num].size, size);
+	memcpy(_buffers[num].data + _buffers[num].size, _frameData + offset, size);
 	_buffers[num].size += size;
 }
 
@@ -99,14 +118,15 @@ void SeqDemuxer::clearBuffer(int num) {
 }
 
 void SeqDemuxer::readPalette(uint8_t *dst) {
-	_f->seek(_frameOffset + _paletteDataOffset);
-	_f->read(dst, 256 * 3);
+	assert(_paletteDataOffset + 256 * 3 <= kFrameSize);
+	memcpy(dst, _frameData + _paletteDataOffset, 256 * 3);
 }
 
 void SeqDemuxer::readAudio(int16_t *dst) {
-	_f->seek(_frameOffset + _audioDataOffset);
+	assert(_audioDataOffset + kAudioBufferSize * 2 <= kFrameSize);
+	const uint8_t *src = _frameData + _audioDataOffset;
 	for (int i = 0; i < kAudioBufferSize; ++i) {
-		dst[i] = _f->readUint16BE();
+		dst[i] = READ_BE_UINT16(src + i * 2);
 	}
 }
 
@@ -217,20 +237,113 @@ static const uint8_t *decodeSeqOp3(uint8_t *dst, int pitch, const uint8_t *src)
 }
 
 SeqPlayer::SeqPlayer(SystemStub *stub, Mixer *mixer)
-	: _stub(stub), _buf(0), _mix(mixer) {
+	: _stub(stub), _buf(0), _mix(mixer), _frames(0), _audioRing(0) {
 	_soundQueuePreloadSize = 0;
-	_soundQueue = 0;
+	_soundStarted = false;
 }
 
 SeqPlayer::~SeqPlayer() {
+	free(_frames);
+	free(_audioRing);
+}
+
+void SeqPlayer::decodeVideo(const uint8_t *src) {
+	BitStream bs(src); src += 128;
+	for (int y = 0; y < kVideoHeight; y += 8) {
+		for (int x = 0; x < kVideoWidth; x += 8) {
+			const int offset = y * kVideoWidth + x;
+			switch (bs.getBits(2)) {
+			case 1:
+				src = decodeSeqOp1(_videoBuffer + offset, kVideoWidth, src);
+				break;
+			case 2:
+				src = decodeSeqOp2(_videoBuffer + offset, kVideoWidth, src);
+				break;
+			case 3:
+				src = decodeSeqOp3(_videoBuffer + offset, kVideoWidth, src);
+				break;
+			}
+		}
+	}
+}
+
+// decoding thread, reads and decodes the frames ahead of their presentation
+void SeqPlayer::decodeFrames() {
+	while (!_decodeStop) {
+		const uint32_t head = _framesHead.load(std::memory_order_relaxed);
+		if (head - _framesTail.load(std::memory_order_acquire) == kFramesQueueSize) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			continue;
+		}
+		if (!_demux.readFrameData()) {
+			break;
+		}
+		Frame *frame = &_frames[head & (kFramesQueueSize - 1)];
+		frame->hasAudio = (_demux._audioDataSize != 0);
+		if (frame->hasAudio) {
+			_demux.readAudio(frame->audio);
+		}
+		frame->hasPalette = (_demux._paletteDataSize != 0);
+		if (frame->hasPalette) {
+			_demux.readPalette(frame->palette);
+			for (int i = 0; i < 256 * 3; ++i) {
+				frame->palette[i] = (frame->palette[i] << 2) | (frame->palette[i] & 3);
+			}
+		}
+		frame->hasVideo = (_demux._videoData != -1);
+		if (frame->hasVideo) {
+			decodeVideo(_demux._buffers[_demux._videoData].data);
+			_demux.clearBuffer(_demux._videoData);
+			memcpy(frame->video, _videoBuffer, sizeof(_videoBuffer));
+		}
+		_framesHead.store(head + 1, std::memory_order_release);
+	}
+	_decodeDone = true;
+}
+
+void SeqPlayer::queueAudio(const int16_t *samples, int count) {
+	const uint32_t head = _audioHead.load(std::memory_order_relaxed);
+	const uint32_t space = kAudioRingSize - (head - _audioTail.load(std::memory_order_acquire));
+	if (count > (int)space) {
+		// the frames are presented faster than the sound is played
+		count = space;
+	}
+	const uint32_t offset = head & (kAudioRingSize - 1);
+	const int count1 = MIN<uint32_t>(count, kAudioRingSize - offset);
+	memcpy(_audioRing + offset, samples, count1 * sizeof(int16_t));
+	memcpy(_audioRing, samples + count1, (count - count1) * sizeof(int16_t));
+	_audioHead.store(head + count, std::memory_order_release);
 }
 
 void SeqPlayer::play(File *f) {
 	if (_demux.open(f)) {
+		// the queues are allocated once and reused by the next cutscenes
+		if (!_frames) {
+			_frames = (Frame *)malloc(kFramesQueueSize * sizeof(Frame));
+		}
+		if (!_audioRing) {
+			_audioRing = (int16_t *)malloc(kAudioRingSize * sizeof(int16_t));
+		}
+		if (!_frames || !_audioRing) {
+			warning("Unable to allocate SEQ frames queue");
+			_demux.close();
+			return;
+		}
 		uint8_t palette[256 * 3];
 		_stub->getPalette(palette, 256);
+		_framesHead = 0;
+		_framesTail = 0;
+		_audioHead = 0;
+		_audioTail = 0;
+		_soundQueuePreloadSize = 0;
+		_soundStarted = false;
+		_resampler.init(1, SeqDemuxer::kAudioSampleRate, _mix->getSampleRate());
 		_mix->setPremixHook(mixCallback, this);
 		memset(_buf, 0, 256 * 224);
+		memset(_videoBuffer, 0, sizeof(_videoBuffer));
+		_decodeStop = false;
+		_decodeDone = false;
+		_decodeThread = std::thread(&SeqPlayer::decodeFrames, this);
 		bool clearScreen = true;
 		while (true) {
 			const uint32_t nextFrameTimeStamp = _stub->getTimeStamp() + 1000 / 25;
@@ -239,68 +352,34 @@ void SeqPlayer::play(File *f) {
 				_stub->_pi.backspace = false;
 				break;
 			}
-			if (!_demux.readFrameData()) {
-				break;
-			}
-			if (_demux._audioDataSize != 0) {
-				SoundBufferQueue *sbq = (SoundBufferQueue *)malloc(sizeof(SoundBufferQueue));
-				if (sbq) {
-					sbq->data = (int16_t *)calloc(SeqDemuxer::kAudioBufferSize, sizeof(int16_t));
-					if (sbq->data) {
-						_demux.readAudio(sbq->data);
-						sbq->size = SeqDemuxer::kAudioBufferSize;
-						sbq->read = 0;
-						sbq->next = 0;
-					} else {
-						free(sbq);
-						sbq = 0;
+			const uint32_t tail = _framesTail.load(std::memory_order_relaxed);
+			if (tail == _framesHead.load(std::memory_order_acquire)) {
+				if (_decodeDone) {
+					if (tail == _framesHead.load(std::memory_order_acquire)) {
+						break;
 					}
+				} else {
+					// the next frame is being decoded
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
 				}
-				if (sbq) {
-					LockAudioStack las(_stub);
-					if (!_soundQueue) {
-						_soundQueue = sbq;
-					} else {
-						SoundBufferQueue *p = _soundQueue;
-						while (p->next) {
-							p = p->next;
-						}
-						p->next = sbq;
-					}
-					if (_soundQueuePreloadSize < kSoundPreloadSize) {
-						++_soundQueuePreloadSize;
+				continue;
+			}
+			const Frame *frame = &_frames[tail & (kFramesQueueSize - 1)];
+			if (frame->hasAudio) {
+				queueAudio(frame->audio, SeqDemuxer::kAudioBufferSize);
+				if (_soundQueuePreloadSize < kSoundPreloadSize) {
+					++_soundQueuePreloadSize;
+					if (_soundQueuePreloadSize == kSoundPreloadSize) {
+						_soundStarted = true;
 					}
 				}
 			}
-			if (_demux._paletteDataSize != 0) {
-				uint8_t buf[256 * 3];
-				_demux.readPalette(buf);
-				for (int i = 0; i < 256 * 3; ++i) {
-					buf[i] = (buf[i] << 2) | (buf[i] & 3);
-				}
-				_stub->setPalette(buf, 256);
+			if (frame->hasPalette) {
+				_stub->setPalette(frame->palette, 256);
 			}
-			if (_demux._videoData != -1) {
+			if (frame->hasVideo) {
 				const int y0 = (224 - kVideoHeight) / 2;
-				const uint8_t *src = _demux._buffers[_demux._videoData].data;
-				_demux.clearBuffer(_demux._videoData);
-				BitStream bs(src); src += 128;
-				for (int y = 0; y < kVideoHeight; y += 8) {
-					for (int x = 0; x < kVideoWidth; x += 8) {
-						const int offset = (y0 + y) * 256 + x;
-						switch (bs.getBits(2)) {
-						case 1:
-							src = decodeSeqOp1(_buf + offset, 256, src);
-							break;
-						case 2:
-							src = decodeSeqOp2(_buf + offset, 256, src);
-							break;
-						case 3:
-							src = decodeSeqOp3(_buf + offset, 256, src);
-							break;
-						}
-					}
-				}
+				memcpy(_buf + y0 * 256, frame->video, kVideoWidth * kVideoHeight);
 				if (clearScreen) {
 					clearScreen = false;
 					_stub->copyRect(0, 0, kVideoWidth, 224, _buf, 256);
@@ -309,46 +388,45 @@ void SeqPlayer::play(File *f) {
 				}
 				_stub->updateScreen(0);
 			}
+			_framesTail.store(tail + 1, std::memory_order_release);
 			const int diff = nextFrameTimeStamp - _stub->getTimeStamp();
 			if (diff > 0) {
 				_stub->sleep(diff);
 			}
 		}
+		_decodeStop = true;
+		_decodeThread.join();
 		// restore level palette
 		_stub->setPalette(palette, 256);
 		_mix->setPremixHook(0, 0);
 		_demux.close();
-		// flush sound queue
-		LockAudioStack las(_stub);
-		while (_soundQueue) {
-			SoundBufferQueue *next = _soundQueue->next;
-			free(_soundQueue->data);
-			free(_soundQueue);
-			_soundQueue = next;
-		}
-		_soundQueuePreloadSize = 0;
 	}
 }
 
-bool SeqPlayer::mix(int16_t *buf, int samples) {
-	if (_soundQueuePreloadSize < kSoundPreloadSize) {
+int SeqPlayer::readSamples(int16_t *buf, int samples) {
+	const uint32_t tail = _audioTail.load(std::memory_order_relaxed);
+	const uint32_t available = _audioHead.load(std::memory_order_acquire) - tail;
+	const int count = MIN<uint32_t>(samples, available);
+	const uint32_t offset = tail & (kAudioRingSize - 1);
+	const int count1 = MIN<uint32_t>(count, kAudioRingSize - offset);
+	memcpy(buf, _audioRing + offset, count1 * sizeof(int16_t));
+	memcpy(buf + count1, _audioRing, (count - count1) * sizeof(int16_t));
+	_audioTail.store(tail + count, std::memory_order_release);
+	return count;
+}
+
+bool SeqPlayer::mix(int16_t *buf, int len) {
+	if (!_soundStarted) {
 		return true;
 	}
-	while (_soundQueue && samples > 0) {
-		*buf++ = _soundQueue->data[_soundQueue->read];
-		++_soundQueue->read;
-		if (_soundQueue->read == _soundQueue->size) {
-			SoundBufferQueue *next = _soundQueue->next;
-			free(_soundQueue->data);
-			free(_soundQueue);
-			_soundQueue = next;
-		}
-		--samples;
-	}
+	_resampler.mix(buf, len, readSamplesCallback, this);
 	return true;
 }
 
+int SeqPlayer::readSamplesCallback(void *param, int16_t *buf, int samples) {
+	return ((SeqPlayer *)param)->readSamples(buf, samples);
+}
+
 bool SeqPlayer::mixCallback(void *param, int16_t *buf, int len) {
 	return ((SeqPlayer *)param)->mix(buf, len);
 }
-
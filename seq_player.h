@@ -7,7 +7,10 @@
 #ifndef SEQ_PLAYER_H__
 #define SEQ_PLAYER_H__
 
+#include <atomic>
+#include <thread>
 #include "intern.h"
+#include "resampler.h"
 
 struct File;
 struct SystemStub;
@@ -17,7 +20,9 @@ struct SeqDemuxer {
 	enum {
 		kFrameSize = 6144,
 		kAudioBufferSize = 882,
-		kBuffersCount = 30
+		kAudioSampleRate = 22050,
+		kBuffersCount = 30,
+		kReadFramesCount = 8
 	};
 
 	bool open(File *f);
@@ -31,6 +36,10 @@ struct SeqDemuxer {
 	void readAudio(int16_t *dst);
 
 	int _frameOffset;
+	const uint8_t *_frameData;
+	uint8_t *_readBuffer; // frames read with a single call
+	int _readBufferOffset;
+	int _readBufferSize;
 	int _audioDataOffset;
 	int _audioDataSize;
 	int _paletteDataOffset;
@@ -49,16 +58,21 @@ struct SeqPlayer {
 	enum {
 		kVideoWidth = 256,
 		kVideoHeight = 128,
-		kSoundPreloadSize = 4
+		kSoundPreloadSize = 4,
+		kFramesQueueSize = 8, // power of 2
+		kAudioRingSize = 16384 // power of 2
 	};
 
 	static const char *_namesTable[];
 
-	struct SoundBufferQueue {
-		int16_t *data;
-		int size;
-		int read;
-		SoundBufferQueue *next;
+	// decoded by the thread, presented by the main thread
+	struct Frame {
+		uint8_t video[kVideoWidth * kVideoHeight];
+		uint8_t palette[256 * 3];
+		int16_t audio[SeqDemuxer::kAudioBufferSize];
+		bool hasVideo;
+		bool hasPalette;
+		bool hasAudio;
 	};
 
 	SeqPlayer(SystemStub *stub, Mixer *mixer);
@@ -66,15 +80,31 @@ struct SeqPlayer {
 
 	void setBackBuffer(uint8_t *buf) { _buf = buf; }
 	void play(File *f);
+	void decodeVideo(const uint8_t *src);
+	void decodeFrames();
+	void queueAudio(const int16_t *samples, int count);
+	int readSamples(int16_t *buf, int samples);
 	bool mix(int16_t *buf, int len);
+	static int readSamplesCallback(void *param, int16_t *buf, int samples);
 	static bool mixCallback(void *param, int16_t *buf, int len);
 
 	SystemStub *_stub;
 	uint8_t *_buf;
 	Mixer *_mix;
 	SeqDemuxer _demux;
+	Frame *_frames;
+	std::atomic<uint32_t> _framesHead; // written by the decoding thread
+	std::atomic<uint32_t> _framesTail; // written by the main thread
+	std::atomic<bool> _decodeStop;
+	std::atomic<bool> _decodeDone;
+	std::thread _decodeThread;
+	uint8_t _videoBuffer[kVideoWidth * kVideoHeight]; // the frames only update some blocks
+	int16_t *_audioRing;
+	std::atomic<uint32_t> _audioHead; // written by the main thread
+	std::atomic<uint32_t> _audioTail; // written by the audio thread
 	int _soundQueuePreloadSize;
-	SoundBufferQueue *_soundQueue;
+	std::atomic<bool> _soundStarted;
+	Resampler _resampler;
 };
 
 #endif // SEQ_PLAYER_H__
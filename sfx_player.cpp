@@ -150,11 +150,9 @@ void SfxPlayer::mixSamples(int16_t *buf, int samplesLen) {
 					}
 					curLen = 0;
 				}
-				while (count--) {
-					const int out = si->getPCM(pos >> FRAC_BITS) * si->vol / kMasterVolume;
-					*mixbuf = ADDC_S16(*mixbuf, S8_to_S16(out));
-					++mixbuf;
-					pos += deltaPos;
+				if (count > 0) {
+					pos = mixSamplesS8(mixbuf, count, (const int8_t *)si->data, pos, deltaPos, si->vol, kMasterVolume);
+					mixbuf += count;
 				}
 			}
 			si->pos = pos;
@@ -163,26 +161,30 @@ void SfxPlayer::mixSamples(int16_t *buf, int samplesLen) {
 }
 
 bool SfxPlayer::mix(int16_t *buf, int len) {
-	memset(buf, 0, sizeof(int16_t) * len);
+	memset(buf, 0, sizeof(int16_t) * len * 2);
 	if (_playing) {
 		const int samplesPerTick = _mix->getSampleRate() / 50;
-		while (len != 0) {
+		// mono samples, converted to stereo frames once mixed
+		int16_t *p = buf;
+		int samples = len;
+		while (samples != 0) {
 			if (_samplesLeft == 0) {
 				handleTick();
 				_samplesLeft = samplesPerTick;
 			}
 			int count = _samplesLeft;
-			if (count > len) {
-				count = len;
+			if (count > samples) {
+				count = samples;
 			}
 			_samplesLeft -= count;
-			len -= count;
-			mixSamples(buf, count);
+			samples -= count;
+			mixSamples(p, count);
 			if (kLowPassFilter) {
-				butterworth(buf, count);
+				butterworth(p, count);
 			}
-			buf += count;
+			p += count;
 		}
+		monoToStereo(buf, len);
 	}
 	return _playing;
 }
@@ -8,6 +8,7 @@
 #define SFX_PLAYER_H__
 
 #include "intern.h"
+#include "mix_kernel.h"
 
 struct Mixer;
 
@@ -15,7 +16,7 @@ struct SfxPlayer {
 	enum {
 		NUM_SAMPLES = 5,
 		NUM_CHANNELS = 3,
-		FRAC_BITS = 12,
+		FRAC_BITS = MIX_FRAC_BITS,
 		PAULA_FREQ = 3546897
 	};
 
@@ -32,15 +33,6 @@ struct SfxPlayer {
 		int freq;
 		int pos;
 		const uint8_t *data;
-
-		int8_t getPCM(int offset) const {
-			if (offset < 0) {
-				offset = 0;
-			} else if (offset >= (int)len) {
-				offset = len - 1;
-			}
-			return (int8_t)data[offset];
-		}
 	};
 
 	static const uint8_t _musicData68[];
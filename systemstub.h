@@ -20,7 +20,8 @@ struct PlayerInput {
 	enum {
 		DF_FASTMODE = 1 << 0,
 		DF_DBLOCKS  = 1 << 1,
-		DF_SETLIFE  = 1 << 2
+		DF_SETLIFE  = 1 << 2,
+		DF_PROFILE  = 1 << 3
 	};
 
 	uint8_t dirMask;
@@ -49,8 +50,24 @@ struct ScalerParameters {
 	static ScalerParameters defaults();
 };
 
+struct VirtualClock {
+	uint32_t _timeStamp;
+
+	VirtualClock() : _timeStamp(0) {}
+
+	// sleeping only advances the clock, each frame lasts exactly its period
+	void sleep(int duration) {
+		if (duration > 0) {
+			_timeStamp += duration;
+		}
+	}
+	uint32_t getTimeStamp() const {
+		return _timeStamp;
+	}
+};
+
 struct SystemStub {
-	typedef void (*AudioCallback)(void *param, int16_t *stream, int len);
+	typedef void (*AudioCallback)(void *param, int16_t *stream, int len); // 'len' stereo frames
 
 	PlayerInput _pi;
 
@@ -80,7 +97,10 @@ struct SystemStub {
 	virtual void processEvents() = 0;
 	virtual void sleep(int duration) = 0;
 	virtual uint32_t getTimeStamp() = 0;
+	virtual void setVirtualTime(bool enable) = 0;
+	virtual void setIndexedPresentation(bool enable) = 0;
 
+	virtual void setAudioParameters(int sampleRate, int samples) = 0;
 	virtual void startAudio(AudioCallback callback, void *param) = 0;
 	virtual void stopAudio() = 0;
 	virtual uint32_t getOutputSampleRate() = 0;
@@ -100,5 +120,6 @@ struct LockAudioStack {
 };
 
 extern SystemStub *SystemStub_SDL_create();
+extern SystemStub *SystemStub_Null_create(int maxFrames);
 
 #endif // SYSTEMSTUB_H__
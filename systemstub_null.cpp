@@ -0,0 +1,229 @@
+
+/*
+ * REminiscence - Flashback interpreter
+ * Copyright (C) 2005-2019 Gregory Montoir (cyx@users.sourceforge.net)
+ */
+
+#include "systemstub.h"
+#include "util.h"
+
+static const int kAudioHz = 22050;
+static const int kAudioBufferSize = 2048;
+
+struct SystemStub_Null : SystemStub {
+	uint8_t *_screenBuffer;
+	int _screenW, _screenH;
+	uint8_t _palette[256 * 3];
+	uint8_t _overscanColor;
+	int _widescreenMode;
+	int _maxFrames;
+	int _framesCount;
+	VirtualClock _clock;
+	uint32_t _audioFrac;
+	void (*_audioCbProc)(void *, int16_t *, int);
+	void *_audioCbData;
+	int _audioSampleRate;
+	int16_t _audioBuffer[kAudioBufferSize * 2];
+
+	SystemStub_Null(int maxFrames)
+		: _maxFrames(maxFrames) {
+	}
+	virtual ~SystemStub_Null() {}
+
+	virtual void init(const char *title, int w, int h, bool fullscreen, int widescreenMode, const ScalerParameters *scalerParameters);
+	virtual void destroy();
+	virtual bool hasWidescreen() const;
+	virtual void setScreenSize(int w, int h);
+	virtual void setPalette(const uint8_t *pal, int n);
+	virtual void getPalette(uint8_t *pal, int n);
+	virtual void setPaletteEntry(int i, const Color *c);
+	virtual void getPaletteEntry(int i, Color *c);
+	virtual void setOverscanColor(int i);
+	virtual void copyRect(int x, int y, int w, int h, const uint8_t *buf, int pitch);
+	virtual void copyRectRgb24(int x, int y, int w, int h, const uint8_t *rgb);
+	virtual void copyWidescreenLeft(int w, int h, const uint8_t *buf, bool dark = true) {}
+	virtual void copyWidescreenRight(int w, int h, const uint8_t *buf, bool dark = true) {}
+	virtual void copyWidescreenMirror(int w, int h, const uint8_t *buf) {}
+	virtual void copyWidescreenBlur(int w, int h, const uint8_t *buf) {}
+	virtual void clearWidescreen() {}
+	virtual void enableWidescreen(bool enable) {}
+	virtual void fadeScreen() {}
+	virtual void updateScreen(int shakeOffset);
+	virtual void processEvents();
+	virtual void sleep(int duration);
+	virtual uint32_t getTimeStamp();
+	virtual void setVirtualTime(bool enable) {}
+	virtual void setIndexedPresentation(bool enable) {}
+	virtual void setAudioParameters(int sampleRate, int samples);
+	virtual void startAudio(AudioCallback callback, void *param);
+	virtual void stopAudio();
+	virtual uint32_t getOutputSampleRate();
+	virtual void lockAudio() {}
+	virtual void unlockAudio() {}
+
+	void mixAudio(int duration);
+};
+
+SystemStub *SystemStub_Null_create(int maxFrames) {
+	return new SystemStub_Null(maxFrames);
+}
+
+void SystemStub_Null::init(const char *title, int w, int h, bool fullscreen, int widescreenMode, const ScalerParameters *scalerParameters) {
+	memset(&_pi, 0, sizeof(_pi));
+	_screenBuffer = 0;
+	_screenW = _screenH = 0;
+	memset(_palette, 0, sizeof(_palette));
+	_overscanColor = 0;
+	_widescreenMode = widescreenMode;
+	_framesCount = 0;
+	_clock = VirtualClock();
+	_audioFrac = 0;
+	_audioCbProc = 0;
+	_audioCbData = 0;
+	_audioSampleRate = kAudioHz;
+	setScreenSize(w, h);
+}
+
+void SystemStub_Null::destroy() {
+	free(_screenBuffer);
+	_screenBuffer = 0;
+	debug(DBG_INFO, "Headless run: %d frames, %d ms", _framesCount, _clock.getTimeStamp());
+}
+
+bool SystemStub_Null::hasWidescreen() const {
+	return _widescreenMode != kWidescreenNone;
+}
+
+void SystemStub_Null::setScreenSize(int w, int h) {
+	if (_screenW == w && _screenH == h) {
+		return;
+	}
+	free(_screenBuffer);
+	_screenBuffer = (uint8_t *)calloc(w, h);
+	if (!_screenBuffer) {
+		error("SystemStub_Null::setScreenSize() Unable to allocate offscreen buffer, w=%d, h=%d", w, h);
+	}
+	_screenW = w;
+	_screenH = h;
+}
+
+void SystemStub_Null::setPalette(const uint8_t *pal, int n) {
+	assert(n <= 256);
+	memcpy(_palette, pal, n * 3);
+}
+
+void SystemStub_Null::getPalette(uint8_t *pal, int n) {
+	assert(n <= 256);
+	memcpy(pal, _palette, n * 3);
+}
+
+void SystemStub_Null::setPaletteEntry(int i, const Color *c) {
+	_palette[i * 3] = c->r;
+	_palette[i * 3 + 1] = c->g;
+	_palette[i * 3 + 2] = c->b;
+}
+
+void SystemStub_Null::getPaletteEntry(int i, Color *c) {
+	c->r = _palette[i * 3];
+	c->g = _palette[i * 3 + 1];
+	c->b = _palette[i * 3 + 2];
+}
+
+void SystemStub_Null::setOverscanColor(int i) {
+	_overscanColor = i;
+}
+
+void SystemStub_Null::copyRect(int x, int y, int w, int h, const uint8_t *buf, int pitch) {
+	if (x < 0) {
+		x = 0;
+	} else if (x >= _screenW) {
+		return;
+	}
+	if (y < 0) {
+		y = 0;
+	} else if (y >= _screenH) {
+		return;
+	}
+	if (x + w > _screenW) {
+		w = _screenW - x;
+	}
+	if (y + h > _screenH) {
+		h = _screenH - y;
+	}
+	uint8_t *p = _screenBuffer + y * _screenW + x;
+	buf += y * pitch + x;
+	for (int j = 0; j < h; ++j) {
+		memcpy(p, buf, w);
+		p += _screenW;
+		buf += pitch;
+	}
+}
+
+void SystemStub_Null::copyRectRgb24(int x, int y, int w, int h, const uint8_t *rgb) {
+	assert(x >= 0 && x + w <= _screenW && y >= 0 && y + h <= _screenH);
+	// keep the luminance, there is no palette for truecolor frames
+	uint8_t *p = _screenBuffer + y * _screenW + x;
+	for (int j = 0; j < h; ++j) {
+		for (int i = 0; i < w; ++i) {
+			p[i] = (rgb[0] * 77 + rgb[1] * 150 + rgb[2] * 29) >> 8; rgb += 3;
+		}
+		p += _screenW;
+	}
+}
+
+void SystemStub_Null::updateScreen(int shakeOffset) {
+	++_framesCount;
+}
+
+void SystemStub_Null::processEvents() {
+	if (_maxFrames > 0 && _framesCount >= _maxFrames) {
+		_pi.quit = true;
+	}
+}
+
+void SystemStub_Null::sleep(int duration) {
+	if (duration > 0) {
+		_clock.sleep(duration);
+		mixAudio(duration);
+	}
+}
+
+uint32_t SystemStub_Null::getTimeStamp() {
+	return _clock.getTimeStamp();
+}
+
+void SystemStub_Null::mixAudio(int duration) {
+	if (!_audioCbProc) {
+		return;
+	}
+	// pull the samples matching the elapsed virtual time
+	const uint32_t total = duration * _audioSampleRate + _audioFrac;
+	_audioFrac = total % 1000;
+	int len = total / 1000;
+	while (len > 0) {
+		const int count = MIN(len, kAudioBufferSize);
+		memset(_audioBuffer, 0, count * 2 * sizeof(int16_t));
+		_audioCbProc(_audioCbData, _audioBuffer, count);
+		len -= count;
+	}
+}
+
+void SystemStub_Null::setAudioParameters(int sampleRate, int samples) {
+	if (sampleRate > 0) {
+		_audioSampleRate = sampleRate;
+	}
+}
+
+void SystemStub_Null::startAudio(AudioCallback callback, void *param) {
+	_audioCbProc = callback;
+	_audioCbData = param;
+}
+
+void SystemStub_Null::stopAudio() {
+	_audioCbProc = 0;
+	_audioCbData = 0;
+}
+
+uint32_t SystemStub_Null::getOutputSampleRate() {
+	return _audioSampleRate;
+}
@@ -4,6 +4,9 @@
  */
 
 #include <SDL.h>
+#include "blur.h"
+#include "pixels.h"
+#include "profiler.h"
 #include "resource.h"
 #include "scaler.h"
 #include "screenshot.h"
@@ -11,6 +14,7 @@
 #include "util.h"
 
 static const int kAudioHz = 22050;
+static const int kAudioSamples = 2048;
 
 static const char *kIconBmp = "icon.bmp";
 
@@ -19,6 +23,23 @@ static const int kJoystickCommitValue = 3200;
 
 static const uint32_t kPixelFormat = SDL_PIXELFORMAT_RGB888;
 
+static const int kMaxDirtyRects = 64;
+
+static const int kWidescreenPanelsCount = 8;
+
+struct WidescreenPanel {
+	uint64_t key;
+	uint32_t *rgb;
+	uint32_t lastUse;
+};
+
+struct DirtyRects {
+	SDL_Rect rects[kMaxDirtyRects];
+	int count;
+
+	void add(int x, int y, int w, int h, int screenW, int screenH);
+};
+
 ScalerParameters ScalerParameters::defaults() {
 	ScalerParameters params;
 	params.type = kScalerTypeInternal;
@@ -34,8 +55,14 @@ struct SystemStub_SDL : SystemStub {
 	int _texW, _texH;
 	SDL_GameController *_controller;
 	SDL_PixelFormat *_fmt;
+	Rgb24Format _rgb24Fmt;
 	const char *_caption;
 	uint32_t *_screenBuffer;
+	uint8_t *_indexedBuffer;
+	uint8_t *_rgb24Mask; // pixels drawn with copyRectRgb24, not backed by the indexed buffer
+	bool _rgb24Drawn;
+	bool _indexedPresentation;
+	bool _paletteChanged;
 	bool _fullscreen;
 	uint8_t _overscanColor;
 	uint32_t _rgbPalette[256];
@@ -46,6 +73,16 @@ struct SystemStub_SDL : SystemStub {
 	bool _fadeOnUpdateScreen;
 	void (*_audioCbProc)(void *, int16_t *, int);
 	void *_audioCbData;
+	int _audioSampleRate;
+	int _audioSamples;
+	SDL_AudioDeviceID _audioDevice;
+	// callbacks timings, microseconds
+	uint64_t _audioLastCallback;
+	uint32_t _audioCallbacksCount;
+	uint32_t _audioUnderrunsCount;
+	uint32_t _audioJitterMax;
+	uint64_t _audioJitterSum;
+	uint32_t _audioMixMax;
 	int _screenshot;
 	ScalerType _scalerType;
 	int _scaleFactor;
@@ -55,6 +92,16 @@ struct SystemStub_SDL : SystemStub {
 	SDL_Texture *_widescreenTexture;
 	int _wideMargin;
 	bool _enableWidescreen;
+	WidescreenPanel _widescreenPanels[kWidescreenPanelsCount];
+	uint32_t _widescreenPanelsCounter;
+	uint32_t *_widescreenBuffer;
+	uint32_t *_widescreenTmp;
+	DirtyRects _dirtyRects;
+	DirtyRects _expandRects;
+	uint32_t *_scaleSrcBuffer;
+	uint32_t *_scaleDstBuffer;
+	bool _virtualTime;
+	VirtualClock _clock;
 
 	virtual ~SystemStub_SDL() {}
 	virtual void init(const char *title, int w, int h, bool fullscreen, int widescreenMode, const ScalerParameters *scalerParameters);
@@ -79,6 +126,9 @@ struct SystemStub_SDL : SystemStub {
 	virtual void processEvents();
 	virtual void sleep(int duration);
 	virtual uint32_t getTimeStamp();
+	virtual void setVirtualTime(bool enable);
+	virtual void setIndexedPresentation(bool enable);
+	virtual void setAudioParameters(int sampleRate, int samples);
 	virtual void startAudio(AudioCallback callback, void *param);
 	virtual void stopAudio();
 	virtual uint32_t getOutputSampleRate();
@@ -93,6 +143,15 @@ struct SystemStub_SDL : SystemStub {
 	void setScaler(const ScalerParameters *parameters);
 	void changeScaler(int scalerNum);
 	void drawRect(int x, int y, int w, int h, uint8_t color);
+	void getProfilerOverlayRect(SDL_Rect *r);
+	void drawProfilerOverlay();
+	void addDirtyRect(int x, int y, int w, int h);
+	void scaleDirtyRects();
+	void expandIndexedRect(const SDL_Rect *r);
+	void expandIndexedRects();
+	void copyWidescreenPanel(int x, int xOffset, int w, int h, const uint8_t *buf, bool dark);
+	const WidescreenPanel *findWidescreenPanel(uint64_t key);
+	WidescreenPanel *allocWidescreenPanel(uint64_t key);
 };
 
 SystemStub *SystemStub_SDL_create() {
@@ -108,9 +167,22 @@ void SystemStub_SDL::init(const char *title, int w, int h, bool fullscreen, int
 	_renderer = 0;
 	_texture = 0;
 	_fmt = SDL_AllocFormat(kPixelFormat);
+	assert(_fmt->Rloss == 0 && _fmt->Gloss == 0 && _fmt->Bloss == 0);
+	_rgb24Fmt.rShift = _fmt->Rshift;
+	_rgb24Fmt.gShift = _fmt->Gshift;
+	_rgb24Fmt.bShift = _fmt->Bshift;
+	_rgb24Fmt.aMask = _fmt->Amask;
 	_screenBuffer = 0;
+	_indexedBuffer = 0;
+	_rgb24Mask = 0;
+	_rgb24Drawn = false;
+	_indexedPresentation = false;
+	_paletteChanged = false;
 	_fadeOnUpdateScreen = false;
 	_fullscreen = fullscreen;
+	_audioSampleRate = kAudioHz;
+	_audioSamples = kAudioSamples;
+	_audioDevice = 0;
 	_scalerType = kScalerTypeInternal;
 	_scaleFactor = 1;
 	_scaler = 0;
@@ -126,6 +198,15 @@ void SystemStub_SDL::init(const char *title, int w, int h, bool fullscreen, int
 	_widescreenTexture = 0;
 	_wideMargin = 0;
 	_enableWidescreen = false;
+	memset(_widescreenPanels, 0, sizeof(_widescreenPanels));
+	_widescreenPanelsCounter = 0;
+	_widescreenBuffer = 0;
+	_widescreenTmp = 0;
+	_dirtyRects.count = 0;
+	_expandRects.count = 0;
+	_scaleSrcBuffer = 0;
+	_scaleDstBuffer = 0;
+	_virtualTime = false;
 	setScreenSize(w, h);
 	_joystick = 0;
 	_controller = 0;
@@ -145,6 +226,10 @@ void SystemStub_SDL::destroy() {
 		free(_screenBuffer);
 		_screenBuffer = 0;
 	}
+	free(_indexedBuffer);
+	_indexedBuffer = 0;
+	free(_rgb24Mask);
+	_rgb24Mask = 0;
 	if (_fmt) {
 		SDL_FreeFormat(_fmt);
 		_fmt = 0;
@@ -179,16 +264,26 @@ void SystemStub_SDL::setScreenSize(int w, int h) {
 	}
 	const int screenBufferSize = w * h * sizeof(uint32_t);
 	_screenBuffer = (uint32_t *)calloc(1, screenBufferSize);
-	if (!_screenBuffer) {
+	free(_indexedBuffer);
+	_indexedBuffer = (uint8_t *)calloc(w, h);
+	free(_rgb24Mask);
+	_rgb24Mask = (uint8_t *)calloc(w, h);
+	_rgb24Drawn = false;
+	if (!_screenBuffer || !_indexedBuffer || !_rgb24Mask) {
 		error("SystemStub_SDL::setScreenSize() Unable to allocate offscreen buffer, w=%d, h=%d", w, h);
 	}
+	_expandRects.count = 0;
 	_screenW = w;
 	_screenH = h;
 	prepareGraphics();
 }
 
 void SystemStub_SDL::setPaletteColor(int color, int r, int g, int b) {
-	_rgbPalette[color] = SDL_MapRGB(_fmt, r, g, b);
+	const uint32_t rgb = SDL_MapRGB(_fmt, r, g, b);
+	if (_rgbPalette[color] != rgb) {
+		_rgbPalette[color] = rgb;
+		_paletteChanged = true;
+	}
 	_shadowPalette[color] = SDL_MapRGB(_fmt, r / 3, g / 3, b / 3);
 	_darkPalette[color] = SDL_MapRGB(_fmt, r / 4, g / 4, b / 4);
 }
@@ -239,15 +334,31 @@ void SystemStub_SDL::copyRect(int x, int y, int w, int h, const uint8_t *buf, in
 		h = _screenH - y;
 	}
 
-	uint32_t *p = _screenBuffer + y * _screenW + x;
 	buf += y * pitch + x;
-
-	for (int j = 0; j < h; ++j) {
-		for (int i = 0; i < w; ++i) {
-			p[i] = _rgbPalette[buf[i]];
+	if (_indexedPresentation) {
+		// the conversion is deferred to updateScreen, skip the unchanged lines
+		uint8_t *p = _indexedBuffer + y * _screenW + x;
+		uint8_t *m = _rgb24Mask + y * _screenW + x;
+		for (int j = 0; j < h; ++j) {
+			bool changed = memcmp(p, buf, w) != 0;
+			if (_rgb24Drawn && (changed || memchr(m, 1, w))) {
+				// the line was drawn over with RGB24 pixels, rewrite it
+				changed = true;
+				memset(m, 0, w);
+			}
+			if (changed) {
+				memcpy(p, buf, w);
+				_expandRects.add(x, y + j, w, 1, _screenW, _screenH);
+				addDirtyRect(x, y + j, w, 1);
+			}
+			p += _screenW;
+			m += _screenW;
+			buf += pitch;
 		}
-		p += _screenW;
-		buf += pitch;
+	} else {
+		uint32_t *p = _screenBuffer + y * _screenW + x;
+		expandPalette(p, _screenW, buf, pitch, w, h, _rgbPalette);
+		addDirtyRect(x, y, w, h);
 	}
 
 	if (_pi.dbgMask & PlayerInput::DF_DBLOCKS) {
@@ -257,18 +368,22 @@ void SystemStub_SDL::copyRect(int x, int y, int w, int h, const uint8_t *buf, in
 
 void SystemStub_SDL::copyRectRgb24(int x, int y, int w, int h, const uint8_t *rgb) {
 	assert(x >= 0 && x + w <= _screenW && y >= 0 && y + h <= _screenH);
-	uint32_t *p = _screenBuffer + y * _screenW + x;
-
-	for (int j = 0; j < h; ++j) {
-		for (int i = 0; i < w; ++i) {
-			p[i] = SDL_MapRGB(_fmt, rgb[0], rgb[1], rgb[2]); rgb += 3;
+	if (_indexedPresentation) {
+		// convert the previous indexed copies before drawing over them
+		expandIndexedRects();
+		// the indexed pixels below are stale, see copyRect and expandIndexedRect
+		for (int j = 0; j < h; ++j) {
+			memset(_rgb24Mask + (y + j) * _screenW + x, 1, w);
 		}
-		p += _screenW;
+		_rgb24Drawn = true;
 	}
+	uint32_t *p = _screenBuffer + y * _screenW + x;
+	expandRgb24(p, _screenW, rgb, w, h, &_rgb24Fmt);
 
 	if (_pi.dbgMask & PlayerInput::DF_DBLOCKS) {
 		drawRect(x, y, w, h, 0xE7);
 	}
+	addDirtyRect(x, y, w, h);
 }
 
 static void clearTexture(SDL_Texture *texture, int h, SDL_PixelFormat *fmt) {
@@ -284,194 +399,123 @@ static void clearTexture(SDL_Texture *texture, int h, SDL_PixelFormat *fmt) {
 	}
 }
 
-static void blur_h(int radius, const uint32_t *src, int srcPitch, int w, int h, const SDL_PixelFormat *fmt, uint32_t *dst, int dstPitch) {
-
-	const int count = 2 * radius + 1;
-
-	for (int y = 0; y < h; ++y) {
-
-		uint32_t r = 0;
-		uint32_t g = 0;
-		uint32_t b = 0;
-
-		uint32_t color;
-
-		for (int x = -radius; x <= radius; ++x) {
-			color = src[MAX(x, 0)];
-			r += (color & fmt->Rmask) >> fmt->Rshift;
-			g += (color & fmt->Gmask) >> fmt->Gshift;
-			b += (color & fmt->Bmask) >> fmt->Bshift;
-		}
-		dst[0] = ((r / count) << fmt->Rshift) | ((g / count) << fmt->Gshift) | ((b / count) << fmt->Bshift);
-
-		for (int x = 1; x < w; ++x) {
-			color = src[MIN(x + radius, w - 1)];
-			r += (color & fmt->Rmask) >> fmt->Rshift;
-			g += (color & fmt->Gmask) >> fmt->Gshift;
-			b += (color & fmt->Bmask) >> fmt->Bshift;
-
-			color = src[MAX(x - radius - 1, 0)];
-			r -= (color & fmt->Rmask) >> fmt->Rshift;
-			g -= (color & fmt->Gmask) >> fmt->Gshift;
-			b -= (color & fmt->Bmask) >> fmt->Bshift;
-
-			dst[x] = ((r / count) << fmt->Rshift) | ((g / count) << fmt->Gshift) | ((b / count) << fmt->Bshift);
+static void clearTextureRect(SDL_Texture *texture, const SDL_Rect *r, SDL_PixelFormat *fmt) {
+	void *dst = 0;
+	int pitch = 0;
+	if (SDL_LockTexture(texture, r, &dst, &pitch) == 0) {
+		assert((pitch & 3) == 0);
+		const uint32_t color = SDL_MapRGB(fmt, 0, 0, 0);
+		for (int y = 0; y < r->h; ++y) {
+			uint32_t *p = (uint32_t *)((uint8_t *)dst + y * pitch);
+			for (int x = 0; x < r->w; ++x) {
+				p[x] = color;
+			}
 		}
-
-		src += srcPitch;
-		dst += dstPitch;
+		SDL_UnlockTexture(texture);
 	}
 }
 
-static void blur_v(int radius, const uint32_t *src, int srcPitch, int w, int h, const SDL_PixelFormat *fmt, uint32_t *dst, int dstPitch) {
-
-	const int count = 2 * radius + 1;
-
-	for (int x = 0; x < w; ++x) {
-
-		uint32_t r = 0;
-		uint32_t g = 0;
-		uint32_t b = 0;
-
-		uint32_t color;
-
-		for (int y = -radius; y <= radius; ++y) {
-			color = src[MAX(y, 0) * srcPitch];
-			r += (color & fmt->Rmask) >> fmt->Rshift;
-			g += (color & fmt->Gmask) >> fmt->Gshift;
-			b += (color & fmt->Bmask) >> fmt->Bshift;
-		}
-		dst[0] = ((r / count) << fmt->Rshift) | ((g / count) << fmt->Gshift) | ((b / count) << fmt->Bshift);
-
-		for (int y = 1; y < h; ++y) {
-			color = src[MIN(y + radius, h - 1) * srcPitch];
-			r += (color & fmt->Rmask) >> fmt->Rshift;
-			g += (color & fmt->Gmask) >> fmt->Gshift;
-			b += (color & fmt->Bmask) >> fmt->Bshift;
-
-			color = src[MAX(y - radius - 1, 0) * srcPitch];
-			r -= (color & fmt->Rmask) >> fmt->Rshift;
-			g -= (color & fmt->Gmask) >> fmt->Gshift;
-			b -= (color & fmt->Bmask) >> fmt->Bshift;
-
-			dst[y * dstPitch] = ((r / count) << fmt->Rshift) | ((g / count) << fmt->Gshift) | ((b / count) << fmt->Bshift);
-		}
-
-		++src;
-		++dst;
+static uint64_t hashWidescreenPanel(uint64_t hash, const uint8_t *buf, int size, const uint32_t *palette) {
+	// FNV-1a on 64 bits words
+	static const uint64_t kPrime = 0x100000001B3ULL;
+	int i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t n;
+		memcpy(&n, buf + i, sizeof(n));
+		hash = (hash ^ n) * kPrime;
+	}
+	for (; i < size; ++i) {
+		hash = (hash ^ buf[i]) * kPrime;
 	}
+	for (i = 0; i < 256; ++i) {
+		hash = (hash ^ palette[i]) * kPrime;
+	}
+	return hash;
 }
 
-void SystemStub_SDL::copyWidescreenLeft(int w, int h, const uint8_t *buf, bool dark) {
-	assert(w >= _wideMargin);
-	uint32_t *rgb = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-	if (rgb) {
-		if (buf) {
-			for (int i = 0; i < w * h; ++i) {
-				if (dark) {
-					rgb[i] = _darkPalette[buf[i]];
-				} else {
-					rgb[i] = _shadowPalette[buf[i]];
-				}
-			}
+void SystemStub_SDL::copyWidescreenPanel(int x, int xOffset, int w, int h, const uint8_t *buf, bool dark) {
+	assert(w >= _wideMargin && w * h <= _screenW * _screenH);
+	SDL_Rect r;
+	r.x = x;
+	r.y = 0;
+	r.w = _wideMargin;
+	r.h = h;
+	if (!buf) {
+		clearTextureRect(_widescreenTexture, &r, _fmt);
+		return;
+	}
+	const uint32_t *palette = dark ? _darkPalette : _shadowPalette;
+	// the same room bitmap and palette give the same panel
+	const uint64_t key = hashWidescreenPanel(0xCBF29CE484222325ULL ^ (xOffset * 2 + dark), buf, w * h, palette);
+	const WidescreenPanel *panel = findWidescreenPanel(key);
+	if (!panel) {
+		WidescreenPanel *p = allocWidescreenPanel(key);
+		if (dark) {
+			expandPalette(p->rgb, _wideMargin, buf + xOffset, w, _wideMargin, h, palette);
 		} else {
-			const uint32_t color = SDL_MapRGB(_fmt, 0, 0, 0);
-			for (int i = 0; i < w * h; ++i) {
-				rgb[i] = color;
+			// the blur reads the columns next to the margin
+			expandPalette(_widescreenBuffer, w, buf, w, w, h, palette);
+			static const int radius = 2;
+			blurImage(radius, _widescreenBuffer, w, _widescreenBuffer, w, w, h, _widescreenTmp);
+			for (int y = 0; y < h; ++y) {
+				memcpy(p->rgb + y * _wideMargin, _widescreenBuffer + y * w + xOffset, _wideMargin * sizeof(uint32_t));
 			}
 		}
+		panel = p;
+	}
+	SDL_UpdateTexture(_widescreenTexture, &r, panel->rgb, _wideMargin * sizeof(uint32_t));
+}
 
-		if (!dark) {
-			uint32_t *tmp = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-
-			if (rgb && tmp) {
-				static const int radius = 2;
-				blur_h(radius, rgb, w, w, h, _fmt, tmp, w);
-				blur_v(radius, tmp, w, w, h, _fmt, rgb, w);
-			}
-
-			free(tmp);
+const WidescreenPanel *SystemStub_SDL::findWidescreenPanel(uint64_t key) {
+	for (int i = 0; i < kWidescreenPanelsCount; ++i) {
+		WidescreenPanel *panel = &_widescreenPanels[i];
+		if (panel->lastUse != 0 && panel->key == key) {
+			panel->lastUse = ++_widescreenPanelsCounter;
+			return panel;
 		}
-
-		const int xOffset = w - _wideMargin;
-		SDL_Rect r;
-		r.x = 0;
-		r.y = 0;
-		r.w = _wideMargin;
-		r.h = h;
-		SDL_UpdateTexture(_widescreenTexture, &r, rgb + xOffset, w * sizeof(uint32_t));
-		free(rgb);
 	}
+	return 0;
 }
 
-void SystemStub_SDL::copyWidescreenRight(int w, int h, const uint8_t *buf, bool dark) {
-	assert(w >= _wideMargin);
-	uint32_t *rgb = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-	if (rgb) {
-		if (buf) {
-			for (int i = 0; i < w * h; ++i) {
-				if (dark) {
-					rgb[i] = _darkPalette[buf[i]];
-				} else {
-					rgb[i] = _shadowPalette[buf[i]];
-				}
-			}
-		} else {
-			const uint32_t color = SDL_MapRGB(_fmt, 0, 0, 0);
-			for (int i = 0; i < w * h; ++i) {
-				rgb[i] = color;
-			}
+WidescreenPanel *SystemStub_SDL::allocWidescreenPanel(uint64_t key) {
+	WidescreenPanel *panel = &_widescreenPanels[0];
+	for (int i = 1; i < kWidescreenPanelsCount; ++i) {
+		if (_widescreenPanels[i].lastUse < panel->lastUse) {
+			panel = &_widescreenPanels[i];
 		}
+	}
+	panel->key = key;
+	panel->lastUse = ++_widescreenPanelsCounter;
+	return panel;
+}
 
-		if (!dark) {
-			uint32_t *tmp = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-
-			if (rgb && tmp) {
-				static const int radius = 2;
-				blur_h(radius, rgb, w, w, h, _fmt, tmp, w);
-				blur_v(radius, tmp, w, w, h, _fmt, rgb, w);
-			}
-
-			free(tmp);
-		}
+void SystemStub_SDL::copyWidescreenLeft(int w, int h, const uint8_t *buf, bool dark) {
+	copyWidescreenPanel(0, w - _wideMargin, w, h, buf, dark);
+}
 
-		const int xOffset = 0;
-		SDL_Rect r;
-		r.x = _wideMargin + _screenW;
-		r.y = 0;
-		r.w = _wideMargin;
-		r.h = h;
-		SDL_UpdateTexture(_widescreenTexture, &r, rgb + xOffset, w * sizeof(uint32_t));
-		free(rgb);
-	}
+void SystemStub_SDL::copyWidescreenRight(int w, int h, const uint8_t *buf, bool dark) {
+	copyWidescreenPanel(_wideMargin + _screenW, 0, w, h, buf, dark);
 }
 
 void SystemStub_SDL::copyWidescreenMirror(int w, int h, const uint8_t *buf) {
 	assert(w >= _wideMargin);
-	uint32_t *rgb = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-	if (rgb) {
-		for (int i = 0; i < w * h; ++i) {
-			rgb[i] = _darkPalette[buf[i]];
-		}
-		void *dst = 0;
-		int pitch = 0;
-		if (SDL_LockTexture(_widescreenTexture, 0, &dst, &pitch) == 0) {
-			assert((pitch & 3) == 0);
-			uint32_t *p = (uint32_t *)dst;
-			for (int y = 0; y < h; ++y) {
-				for (int x = 0; x < _wideMargin; ++x) {
-					// left side
-					const int xLeft = _wideMargin - 1 - x;
-					p[x] = rgb[y * w + xLeft];
-					// right side
-					const int xRight = w - 1 - x;
-					p[_wideMargin + _screenW + x] = rgb[y * w + xRight];
-				}
-				p += pitch / sizeof(uint32_t);
+	void *dst = 0;
+	int pitch = 0;
+	if (SDL_LockTexture(_widescreenTexture, 0, &dst, &pitch) == 0) {
+		assert((pitch & 3) == 0);
+		uint32_t *p = (uint32_t *)dst;
+		for (int y = 0; y < h; ++y) {
+			for (int x = 0; x < _wideMargin; ++x) {
+				// left side
+				const int xLeft = _wideMargin - 1 - x;
+				p[x] = _darkPalette[buf[y * w + xLeft]];
+				// right side
+				const int xRight = w - 1 - x;
+				p[_wideMargin + _screenW + x] = _darkPalette[buf[y * w + xRight]];
 			}
-			SDL_UnlockTexture(_widescreenTexture);
+			p += pitch / sizeof(uint32_t);
 		}
-		free(rgb);
+		SDL_UnlockTexture(_widescreenTexture);
 	}
 }
 
@@ -481,23 +525,9 @@ void SystemStub_SDL::copyWidescreenBlur(int w, int h, const uint8_t *buf) {
 	int pitch = 0;
 	if (SDL_LockTexture(_widescreenTexture, 0, &ptr, &pitch) == 0) {
 		assert((pitch & 3) == 0);
-
-		uint32_t *src = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-		uint32_t *tmp = (uint32_t *)malloc(w * h * sizeof(uint32_t));
-		uint32_t *dst = (uint32_t *)ptr;
-
-		if (src && tmp) {
-			for (int i = 0; i < w * h; ++i) {
-				src[i] = _rgbPalette[buf[i]];
-			}
-			static const int radius = 8;
-			blur_h(radius, src, w, w, h, _fmt, tmp, w);
-			blur_v(radius, tmp, w, w, h, _fmt, dst, pitch / sizeof(uint32_t));
-		}
-
-		free(src);
-		free(tmp);
-
+		expandPalette(_widescreenBuffer, w, buf, w, w, h, _rgbPalette);
+		static const int radius = 8;
+		blurImage(radius, (uint32_t *)ptr, pitch / sizeof(uint32_t), _widescreenBuffer, w, w, h, _widescreenTmp);
 		SDL_UnlockTexture(_widescreenTexture);
 	}
 }
@@ -515,16 +545,24 @@ void SystemStub_SDL::fadeScreen() {
 }
 
 void SystemStub_SDL::updateScreen(int shakeOffset) {
-	if (_texW != _screenW || _texH != _screenH) {
-		void *dst = 0;
-		int pitch = 0;
-		if (SDL_LockTexture(_texture, 0, &dst, &pitch) == 0) {
-			assert((pitch & 3) == 0);
-			_scaler->scale(_scaleFactor, (uint32_t *)dst, pitch / sizeof(uint32_t), _screenBuffer, _screenW, _screenW, _screenH);
-			SDL_UnlockTexture(_texture);
+	if (_indexedPresentation) {
+		expandIndexedRects();
+	}
+	if (_dirtyRects.count != 0) {
+		if (_texW != _screenW || _texH != _screenH) {
+			g_profiler.begin(kProfileScaler);
+			scaleDirtyRects();
+			g_profiler.end(kProfileScaler);
+		} else {
+			for (int i = 0; i < _dirtyRects.count; ++i) {
+				const SDL_Rect *r = &_dirtyRects.rects[i];
+				SDL_UpdateTexture(_texture, r, _screenBuffer + r->y * _screenW + r->x, _screenW * sizeof(uint32_t));
+			}
 		}
-	} else {
-		SDL_UpdateTexture(_texture, 0, _screenBuffer, _screenW * sizeof(uint32_t));
+		_dirtyRects.count = 0;
+	}
+	if (_pi.dbgMask & PlayerInput::DF_PROFILE) {
+		drawProfilerOverlay();
 	}
 	SDL_RenderClear(_renderer);
 	if (_widescreenMode != kWidescreenNone) {
@@ -562,7 +600,9 @@ void SystemStub_SDL::updateScreen(int shakeOffset) {
 		SDL_RenderGetLogicalSize(_renderer, &r.w, &r.h);
 		SDL_RenderCopy(_renderer, _texture, 0, &r);
 	}
+	g_profiler.begin(kProfilePresent);
 	SDL_RenderPresent(_renderer);
+	g_profiler.end(kProfilePresent);
 }
 
 void SystemStub_SDL::processEvents() {
@@ -609,7 +649,13 @@ void SystemStub_SDL::processEvent(const SDL_Event &ev, bool &paused) {
 		case SDL_WINDOWEVENT_FOCUS_GAINED:
 		case SDL_WINDOWEVENT_FOCUS_LOST:
 			paused = (ev.window.event == SDL_WINDOWEVENT_FOCUS_LOST);
-			SDL_PauseAudio(paused);
+			if (_audioDevice) {
+				SDL_PauseAudioDevice(_audioDevice, paused);
+				// do not measure the pause as a callback interval
+				SDL_LockAudioDevice(_audioDevice);
+				_audioLastCallback = 0;
+				SDL_UnlockAudioDevice(_audioDevice);
+			}
 			break;
 		}
 		break;
@@ -779,6 +825,9 @@ void SystemStub_SDL::processEvent(const SDL_Event &ev, bool &paused) {
 			case SDLK_s: {
 					char name[32];
 					snprintf(name, sizeof(name), "screenshot-%03d.tga", _screenshot);
+					if (_indexedPresentation) {
+						expandIndexedRects();
+					}
 					saveTGA(name, (const uint8_t *)_screenBuffer, _screenW, _screenH);
 					++_screenshot;
 					debug(DBG_INFO, "Written '%s'", name);
@@ -800,6 +849,17 @@ void SystemStub_SDL::processEvent(const SDL_Event &ev, bool &paused) {
 			case SDLK_i:
 				_pi.dbgMask ^= PlayerInput::DF_SETLIFE;
 				break;
+			case SDLK_p:
+				_pi.dbgMask ^= PlayerInput::DF_PROFILE;
+				if (_pi.dbgMask & PlayerInput::DF_PROFILE) {
+					g_profiler.enable();
+				} else {
+					// upload the game pixels below the overlay
+					SDL_Rect r;
+					getProfilerOverlayRect(&r);
+					addDirtyRect(r.x, r.y, r.w, r.h);
+				}
+				break;
 			case SDLK_s:
 				_pi.save = true;
 				break;
@@ -905,51 +965,130 @@ void SystemStub_SDL::processEvent(const SDL_Event &ev, bool &paused) {
 }
 
 void SystemStub_SDL::sleep(int duration) {
+	if (_virtualTime) {
+		_clock.sleep(duration);
+		return;
+	}
 	SDL_Delay(duration);
 }
 
 uint32_t SystemStub_SDL::getTimeStamp() {
+	if (_virtualTime) {
+		return _clock.getTimeStamp();
+	}
 	return SDL_GetTicks();
 }
 
+void SystemStub_SDL::setVirtualTime(bool enable) {
+	if (enable && !_virtualTime) {
+		_clock._timeStamp = SDL_GetTicks();
+	}
+	_virtualTime = enable;
+}
+
+void SystemStub_SDL::setIndexedPresentation(bool enable) {
+	if (enable != _indexedPresentation) {
+		// the indexed buffer is not kept up to date in truecolor mode
+		memset(_indexedBuffer, 0, _screenW * _screenH);
+		memset(_rgb24Mask, 0, _screenW * _screenH);
+		_rgb24Drawn = false;
+		_expandRects.count = 0;
+		_paletteChanged = false;
+		_indexedPresentation = enable;
+	}
+}
+
+static uint64_t getAudioTimeUs() {
+	static const uint64_t freq = SDL_GetPerformanceFrequency();
+	const uint64_t t = SDL_GetPerformanceCounter();
+	return (t / freq) * 1000000 + (t % freq) * 1000000 / freq;
+}
+
 static void mixAudioS16(void *param, uint8_t *buf, int len) {
 	SystemStub_SDL *stub = (SystemStub_SDL *)param;
+	const int frames = len / (2 * sizeof(int16_t));
+	const uint64_t now = getAudioTimeUs();
+	if (stub->_audioLastCallback != 0) {
+		// the callbacks are expected every period, the device runs dry when one is later than the queued buffer
+		const uint32_t period = (uint64_t)frames * 1000000 / stub->_audioSampleRate;
+		const uint32_t interval = now - stub->_audioLastCallback;
+		const uint32_t jitter = (interval > period) ? interval - period : period - interval;
+		stub->_audioJitterSum += jitter;
+		if (jitter > stub->_audioJitterMax) {
+			stub->_audioJitterMax = jitter;
+		}
+		if (interval > period * 2) {
+			++stub->_audioUnderrunsCount;
+		}
+		++stub->_audioCallbacksCount;
+	}
+	stub->_audioLastCallback = now;
 	memset(buf, 0, len);
-	stub->_audioCbProc(stub->_audioCbData, (int16_t *)buf, len / 2);
+	stub->_audioCbProc(stub->_audioCbData, (int16_t *)buf, frames);
+	const uint32_t mixDuration = getAudioTimeUs() - now;
+	if (mixDuration > stub->_audioMixMax) {
+		stub->_audioMixMax = mixDuration;
+	}
+}
+
+void SystemStub_SDL::setAudioParameters(int sampleRate, int samples) {
+	if (sampleRate > 0) {
+		_audioSampleRate = sampleRate;
+	}
+	if (samples > 0) {
+		_audioSamples = samples;
+	}
 }
 
 void SystemStub_SDL::startAudio(AudioCallback callback, void *param) {
-	SDL_AudioSpec desired;
+	SDL_AudioSpec desired, obtained;
 	memset(&desired, 0, sizeof(desired));
-	desired.freq = kAudioHz;
+	desired.freq = _audioSampleRate;
 	desired.format = AUDIO_S16SYS;
-	desired.channels = 1;
-	desired.samples = 2048;
+	desired.channels = 2;
+	desired.samples = _audioSamples;
 	desired.callback = mixAudioS16;
 	desired.userdata = this;
-	if (SDL_OpenAudio(&desired, 0) == 0) {
-		_audioCbProc = callback;
-		_audioCbData = param;
-		SDL_PauseAudio(0);
+	_audioCbProc = callback;
+	_audioCbData = param;
+	_audioLastCallback = 0;
+	_audioCallbacksCount = 0;
+	_audioUnderrunsCount = 0;
+	_audioJitterMax = 0;
+	_audioJitterSum = 0;
+	_audioMixMax = 0;
+	// the sounds are resampled to the device rate, the device may also use a larger period
+	_audioDevice = SDL_OpenAudioDevice(0, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if (_audioDevice != 0) {
+		_audioSampleRate = obtained.freq;
+		_audioSamples = obtained.samples;
+		debug(DBG_INFO, "Audio device rate %d Hz, %d samples period", _audioSampleRate, _audioSamples);
+		SDL_PauseAudioDevice(_audioDevice, 0);
 	} else {
 		error("SystemStub_SDL::startAudio() Unable to open sound device");
 	}
 }
 
 void SystemStub_SDL::stopAudio() {
-	SDL_CloseAudio();
+	if (_audioDevice != 0) {
+		SDL_CloseAudioDevice(_audioDevice);
+		_audioDevice = 0;
+		if (_audioCallbacksCount != 0) {
+			debug(DBG_INFO, "Audio callbacks %d, jitter avg %d max %d us, mix max %d us, underruns %d", _audioCallbacksCount, (int)(_audioJitterSum / _audioCallbacksCount), _audioJitterMax, _audioMixMax, _audioUnderrunsCount);
+		}
+	}
 }
 
 uint32_t SystemStub_SDL::getOutputSampleRate() {
-	return kAudioHz;
+	return _audioSampleRate;
 }
 
 void SystemStub_SDL::lockAudio() {
-	SDL_LockAudio();
+	SDL_LockAudioDevice(_audioDevice);
 }
 
 void SystemStub_SDL::unlockAudio() {
-	SDL_UnlockAudio();
+	SDL_UnlockAudioDevice(_audioDevice);
 }
 
 static bool is16_9(const SDL_DisplayMode *mode) {
@@ -1001,6 +1140,16 @@ void SystemStub_SDL::prepareGraphics() {
 	_renderer = SDL_CreateRenderer(_window, -1, SDL_RENDERER_ACCELERATED);
 	SDL_RenderSetLogicalSize(_renderer, windowW, windowH);
 	_texture = SDL_CreateTexture(_renderer, kPixelFormat, SDL_TEXTUREACCESS_STREAMING, _texW, _texH);
+	if (_texW != _screenW || _texH != _screenH) {
+		_scaleSrcBuffer = (uint32_t *)malloc(_screenW * _screenH * sizeof(uint32_t));
+		_scaleDstBuffer = (uint32_t *)malloc(_texW * _texH * sizeof(uint32_t));
+		if (!_scaleSrcBuffer || !_scaleDstBuffer) {
+			error("SystemStub_SDL::prepareGraphics() Unable to allocate scaler buffers, w=%d, h=%d", _texW, _texH);
+		}
+	}
+	// the new texture needs a full upload
+	_dirtyRects.count = 0;
+	addDirtyRect(0, 0, _screenW, _screenH);
 	if (_widescreenMode != kWidescreenNone) {
 		// in blur mode, the background texture has the same dimensions as the game texture
 		// SDL stretches the texture to 16:9
@@ -1011,10 +1160,31 @@ void SystemStub_SDL::prepareGraphics() {
 
 		// left and right borders
 		_wideMargin = (w - _screenW) / 2;
+
+		// scratch buffers for the blur, followed by the side panels cache
+		const int size = _screenW * _screenH;
+		const int panelSize = _wideMargin * _screenH;
+		_widescreenBuffer = (uint32_t *)malloc((size * 2 + panelSize * kWidescreenPanelsCount) * sizeof(uint32_t));
+		if (!_widescreenBuffer) {
+			error("SystemStub_SDL::prepareGraphics() Unable to allocate widescreen buffers, w=%d, h=%d", w, h);
+		}
+		_widescreenTmp = _widescreenBuffer + size;
+		for (int i = 0; i < kWidescreenPanelsCount; ++i) {
+			_widescreenPanels[i].rgb = _widescreenTmp + size + i * panelSize;
+		}
 	}
 }
 
 void SystemStub_SDL::cleanupGraphics() {
+	// the panels width depends on the window size
+	memset(_widescreenPanels, 0, sizeof(_widescreenPanels));
+	free(_widescreenBuffer);
+	_widescreenBuffer = 0;
+	_widescreenTmp = 0;
+	free(_scaleSrcBuffer);
+	_scaleSrcBuffer = 0;
+	free(_scaleDstBuffer);
+	_scaleDstBuffer = 0;
 	if (_texture) {
 		SDL_DestroyTexture(_texture);
 		_texture = 0;
@@ -1152,10 +1322,209 @@ void SystemStub_SDL::drawRect(int x, int y, int w, int h, uint8_t color) {
 	const int x2 = x + w - 1;
 	const int y2 = y + h - 1;
 	assert(x1 >= 0 && x2 < _screenW && y1 >= 0 && y2 < _screenH);
-	for (int i = x1; i <= x2; ++i) {
-		*(_screenBuffer + y1 * _screenW + i) = *(_screenBuffer + y2 * _screenW + i) = _rgbPalette[color];
+	if (_indexedPresentation) {
+		for (int i = x1; i <= x2; ++i) {
+			*(_indexedBuffer + y1 * _screenW + i) = *(_indexedBuffer + y2 * _screenW + i) = color;
+			*(_rgb24Mask + y1 * _screenW + i) = *(_rgb24Mask + y2 * _screenW + i) = 0;
+		}
+		for (int j = y1; j <= y2; ++j) {
+			*(_indexedBuffer + j * _screenW + x1) = *(_indexedBuffer + j * _screenW + x2) = color;
+			*(_rgb24Mask + j * _screenW + x1) = *(_rgb24Mask + j * _screenW + x2) = 0;
+		}
+		// only the borders, the inside can be RGB24 pixels
+		_expandRects.add(x1, y1, w, 1, _screenW, _screenH);
+		_expandRects.add(x1, y2, w, 1, _screenW, _screenH);
+		_expandRects.add(x1, y1, 1, h, _screenW, _screenH);
+		_expandRects.add(x2, y1, 1, h, _screenW, _screenH);
+	} else {
+		for (int i = x1; i <= x2; ++i) {
+			*(_screenBuffer + y1 * _screenW + i) = *(_screenBuffer + y2 * _screenW + i) = _rgbPalette[color];
+		}
+		for (int j = y1; j <= y2; ++j) {
+			*(_screenBuffer + j * _screenW + x1) = *(_screenBuffer + j * _screenW + x2) = _rgbPalette[color];
+		}
 	}
-	for (int j = y1; j <= y2; ++j) {
-		*(_screenBuffer + j * _screenW + x1) = *(_screenBuffer + j * _screenW + x2) = _rgbPalette[color];
+	addDirtyRect(x, y, w, h);
+}
+
+void DirtyRects::add(int x, int y, int w, int h, int screenW, int screenH) {
+	if (count != 0) {
+		SDL_Rect *r = &rects[count - 1];
+		if (r->x == x && r->w == w && r->y + r->h == y) {
+			// Video::updateScreen() sends the blocks row by row
+			r->h += h;
+			return;
+		}
+		if (count == kMaxDirtyRects || (r->x == 0 && r->y == 0 && r->w == screenW && r->h == screenH)) {
+			rects[0].x = rects[0].y = 0;
+			rects[0].w = screenW;
+			rects[0].h = screenH;
+			count = 1;
+			return;
+		}
+	}
+	SDL_Rect *r = &rects[count++];
+	r->x = x;
+	r->y = y;
+	r->w = w;
+	r->h = h;
+}
+
+void SystemStub_SDL::addDirtyRect(int x, int y, int w, int h) {
+	_dirtyRects.add(x, y, w, h, _screenW, _screenH);
+}
+
+void SystemStub_SDL::expandIndexedRect(const SDL_Rect *r) {
+	if (!_rgb24Drawn) {
+		const int offset = r->y * _screenW + r->x;
+		expandPalette(_screenBuffer + offset, _screenW, _indexedBuffer + offset, _screenW, r->w, r->h, _rgbPalette);
+		return;
+	}
+	// keep the RGB24 pixels, convert the runs of indexed pixels
+	for (int y = r->y; y < r->y + r->h; ++y) {
+		const uint8_t *m = _rgb24Mask + y * _screenW;
+		int x = r->x;
+		while (x < r->x + r->w) {
+			if (m[x]) {
+				++x;
+				continue;
+			}
+			const int x0 = x;
+			while (x < r->x + r->w && !m[x]) {
+				++x;
+			}
+			const int offset = y * _screenW + x0;
+			expandPalette(_screenBuffer + offset, _screenW, _indexedBuffer + offset, _screenW, x - x0, 1, _rgbPalette);
+		}
+	}
+}
+
+void SystemStub_SDL::expandIndexedRects() {
+	if (_paletteChanged) {
+		// the whole screen uses the palette
+		_paletteChanged = false;
+		_expandRects.count = 0;
+		_expandRects.add(0, 0, _screenW, _screenH, _screenW, _screenH);
+		addDirtyRect(0, 0, _screenW, _screenH);
+	}
+	for (int i = 0; i < _expandRects.count; ++i) {
+		expandIndexedRect(&_expandRects.rects[i]);
+	}
+	_expandRects.count = 0;
+}
+
+static int getScalerRadius(const Scaler *scaler, int factor) {
+	if (scaler == &_internalScaler) {
+		return (factor == 4) ? 2 : 1; // scale4x is two scale2x passes
+	} else if (scaler == &scaler_xbr) {
+		return 2;
+	}
+	return -1;
+}
+
+void SystemStub_SDL::scaleDirtyRects() {
+	const int radius = getScalerRadius(_scaler, _scaleFactor);
+	if (radius < 0) {
+		// unknown kernel size, rescale the whole screen
+		void *dst = 0;
+		int pitch = 0;
+		if (SDL_LockTexture(_texture, 0, &dst, &pitch) == 0) {
+			assert((pitch & 3) == 0);
+			_scaler->scale(_scaleFactor, (uint32_t *)dst, pitch / sizeof(uint32_t), _screenBuffer, _screenW, _screenW, _screenH);
+			SDL_UnlockTexture(_texture);
+		}
+		return;
+	}
+	const int factor = _scaleFactor;
+	for (int i = 0; i < _dirtyRects.count; ++i) {
+		const SDL_Rect *r = &_dirtyRects.rects[i];
+		// the output pixels within the kernel radius of the rectangle read the changed pixels
+		const int ux0 = MAX(r->x - radius, 0);
+		const int uy0 = MAX(r->y - radius, 0);
+		const int ux1 = MIN(r->x + r->w + radius, _screenW);
+		const int uy1 = MIN(r->y + r->h + radius, _screenH);
+		// and the scaler reads the pixels within the kernel radius of these
+		const int x0 = MAX(ux0 - radius, 0);
+		const int y0 = MAX(uy0 - radius, 0);
+		const int x1 = MIN(ux1 + radius, _screenW);
+		const int y1 = MIN(uy1 + radius, _screenH);
+		const int w = x1 - x0;
+		const int h = y1 - y0;
+		// xBRZ does not support pitches, copy to a contiguous buffer
+		for (int y = 0; y < h; ++y) {
+			memcpy(_scaleSrcBuffer + y * w, _screenBuffer + (y0 + y) * _screenW + x0, w * sizeof(uint32_t));
+		}
+		_scaler->scale(factor, _scaleDstBuffer, w * factor, _scaleSrcBuffer, w, w, h);
+		SDL_Rect texRect;
+		texRect.x = ux0 * factor;
+		texRect.y = uy0 * factor;
+		texRect.w = (ux1 - ux0) * factor;
+		texRect.h = (uy1 - uy0) * factor;
+		const uint32_t *p = _scaleDstBuffer + (uy0 - y0) * factor * (w * factor) + (ux0 - x0) * factor;
+		SDL_UpdateTexture(_texture, &texRect, p, w * factor * sizeof(uint32_t));
+	}
+}
+
+static const int kProfilerBarW = 128;
+
+void SystemStub_SDL::getProfilerOverlayRect(SDL_Rect *r) {
+	r->x = 4;
+	r->y = 4;
+	r->w = kProfilerBarW;
+	r->h = MIN(kProfilePhasesCount * 3, _screenH - r->y);
+}
+
+static void fillRect32(uint32_t *dst, int pitch, int x, int y, int w, int h, uint32_t color) {
+	dst += y * pitch + x;
+	for (int j = 0; j < h; ++j) {
+		for (int i = 0; i < w; ++i) {
+			dst[i] = color;
+		}
+		dst += pitch;
+	}
+}
+
+void SystemStub_SDL::drawProfilerOverlay() {
+	// one bar per phase, the full width is the 33ms frame budget ;
+	// the bars are drawn over the texture, the screen buffers keep the game pixels
+	static const int kBudgetUs = 1000000 / 30;
+	SDL_Rect r;
+	getProfilerOverlayRect(&r);
+	uint32_t buf[kProfilerBarW * kProfilePhasesCount * 3];
+	for (int y = 0; y < r.h; ++y) {
+		memcpy(buf + y * r.w, _screenBuffer + (r.y + y) * _screenW + r.x, r.w * sizeof(uint32_t));
+	}
+	for (int i = 0; i < kProfilePhasesCount; ++i) {
+		const ProfileStats *stats = &g_profiler._stats[i];
+		const int y = i * 3;
+		if (y + 2 > r.h) {
+			break;
+		}
+		fillRect32(buf, r.w, 0, y, kProfilerBarW, 2, _rgbPalette[0xE0]);
+		const int avgW = MIN<uint32_t>(stats->avg, kBudgetUs) * kProfilerBarW / kBudgetUs;
+		if (avgW > 0) {
+			fillRect32(buf, r.w, 0, y, avgW, 2, _rgbPalette[(stats->p99 > kBudgetUs) ? 0xE4 : 0xEB]);
+		}
+		const int p99X = MIN<uint32_t>(stats->p99, kBudgetUs - 1) * kProfilerBarW / kBudgetUs;
+		fillRect32(buf, r.w, p99X, y, 1, 2, _rgbPalette[0xEE]);
+	}
+	const int factor = _texW / _screenW;
+	if (factor == 1) {
+		SDL_UpdateTexture(_texture, &r, buf, r.w * sizeof(uint32_t));
+		return;
+	}
+	// nearest pixel scaling
+	const int pitch = r.w * factor;
+	for (int y = 0; y < r.h * factor; ++y) {
+		const uint32_t *src = buf + (y / factor) * r.w;
+		for (int x = 0; x < pitch; ++x) {
+			_scaleDstBuffer[y * pitch + x] = src[x / factor];
+		}
 	}
+	SDL_Rect texRect;
+	texRect.x = r.x * factor;
+	texRect.y = r.y * factor;
+	texRect.w = r.w * factor;
+	texRect.h = r.h * factor;
+	SDL_UpdateTexture(_texture, &texRect, _scaleDstBuffer, pitch * sizeof(uint32_t));
 }
@@ -244,6 +244,25 @@ static void PC_decodeMapPlane(int sz, const uint8_t *src, uint8_t *dst) {
 	}
 }
 
+bool Video::loadCachedRoom(int level, int room) {
+	const RoomCacheEntry *e = _roomCache.find(level, room, _res->_levNum);
+	if (!e) {
+		return false;
+	}
+	memcpy(_frontLayer, e->layer, _layerSize);
+	memcpy(_backLayer, e->layer, _layerSize);
+	_mapPalSlot1 = e->palSlots[0];
+	_mapPalSlot2 = e->palSlots[1];
+	_mapPalSlot3 = e->palSlots[2];
+	_mapPalSlot4 = e->palSlots[3];
+	return true;
+}
+
+void Video::saveCachedRoom(int level, int room) {
+	const uint8_t palSlots[] = { _mapPalSlot1, _mapPalSlot2, _mapPalSlot3, _mapPalSlot4 };
+	_roomCache.insert(level, room, _res->_levNum, _backLayer, _layerSize, palSlots);
+}
+
 void Video::PC_decodeMap(int level, int room) {
 	debug(DBG_VIDEO, "Video::PC_decodeMap(%d)", room);
 	if (!_res->_map) {
@@ -252,6 +271,10 @@ void Video::PC_decodeMap(int level, int room) {
 		return;
 	}
 	assert(room < 0x40);
+	if (loadCachedRoom(level, room)) {
+		PC_setLevelPalettes();
+		return;
+	}
 	int32_t off = READ_LE_UINT32(_res->_map + room * 6);
 	if (off == 0) {
 		error("Invalid room %d", room);
@@ -288,6 +311,7 @@ void Video::PC_decodeMap(int level, int room) {
 		}
 	}
 	memcpy(_backLayer, _frontLayer, _layerSize);
+	saveCachedRoom(level, room);
 	PC_setLevelPalettes();
 }
 
@@ -678,6 +702,10 @@ static void decodeLevHelper(uint8_t *dst, const uint8_t *src, int offset10, int
 }
 
 void Video::AMIGA_decodeLev(int level, int room) {
+	if (loadCachedRoom(level, room)) {
+		AMIGA_setLevelPalettes(level);
+		return;
+	}
 	uint8_t *tmp = _res->_scratchBuffer;
 	const int offset = READ_BE_UINT32(_res->_lev + room * 4);
 	if (!bytekiller_unpack(tmp, Resource::kScratchBufferSize, _res->_lev, offset)) {
@@ -734,6 +762,11 @@ void Video::AMIGA_decodeLev(int level, int room) {
 	_mapPalSlot2 = READ_BE_UINT16(tmp + 4);
 	_mapPalSlot3 = READ_BE_UINT16(tmp + 6);
 	_mapPalSlot4 = READ_BE_UINT16(tmp + 8);
+	saveCachedRoom(level, room);
+	AMIGA_setLevelPalettes(level);
+}
+
+void Video::AMIGA_setLevelPalettes(int level) {
 	if (_res->isDOS()) {
 		PC_setLevelPalettes();
 		if (level == 0) { // tiles with color slot 0x9
@@ -1009,14 +1042,17 @@ Color Video::AMIGA_convertColor(const uint16_t color, bool bgr) { // 4bits to 8b
 }
 
 void Video::MAC_decodeMap(int level, int room) {
-	DecodeBuffer buf;
-	memset(&buf, 0, sizeof(buf));
-	buf.ptr = _frontLayer;
-	buf.w = buf.pitch = _w;
-	buf.h = _h;
-	buf.setPixel = Video::MAC_setPixel;
-	_res->MAC_loadLevelRoom(level, room, &buf);
-	memcpy(_backLayer, _frontLayer, _layerSize);
+	if (!loadCachedRoom(level, room)) {
+		DecodeBuffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.ptr = _frontLayer;
+		buf.w = buf.pitch = _w;
+		buf.h = _h;
+		buf.setPixel = Video::MAC_setPixel;
+		_res->MAC_loadLevelRoom(level, room, &buf);
+		memcpy(_backLayer, _frontLayer, _layerSize);
+		saveCachedRoom(level, room);
+	}
 	Color roomPalette[256];
 	_res->MAC_setupRoomClut(level, room, roomPalette);
 	for (int j = 0; j < 16; ++j) {
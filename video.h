@@ -8,6 +8,7 @@
 #define VIDEO_H__
 
 #include "intern.h"
+#include "room_cache.h"
 
 struct Resource;
 struct SystemStub;
@@ -50,6 +51,7 @@ struct Video {
 	bool _fullRefresh;
 	uint8_t _shakeOffset;
 	drawCharFunc _drawChar;
+	RoomCache _roomCache;
 
 	Video(Resource *res, SystemStub *stub, WidescreenMode widescreenMode);
 	~Video();
@@ -66,12 +68,15 @@ struct Video {
 	void setTextPalette();
 	void setPalette0xF();
 	void PC_decodeLev(int level, int room);
+	bool loadCachedRoom(int level, int room);
+	void saveCachedRoom(int level, int room);
 	void PC_decodeMap(int level, int room);
 	void PC_setLevelPalettes();
 	void PC_decodeIcn(const uint8_t *src, int num, uint8_t *dst);
 	void PC_decodeSpc(const uint8_t *src, int w, int h, uint8_t *dst);
 	void PC_decodeSpm(const uint8_t *dataPtr, uint8_t *dstPtr);
 	void AMIGA_decodeLev(int level, int room);
+	void AMIGA_setLevelPalettes(int level);
 	void AMIGA_decodeSpm(const uint8_t *src, uint8_t *dst);
 	void AMIGA_decodeIcn(const uint8_t *src, int num, uint8_t *dst);
 	void AMIGA_decodeSpc(const uint8_t *src, int w, int h, uint8_t *dst);